@@ -0,0 +1,208 @@
+/*
+ * Copyight (C) Eitan Ben-Amos, 2012
+ *
+ * A multi-producer benchmark of the msg queue of an engine.
+ * N producer pthreads send msgs to the silks of a single engine as fast as they can (each
+ * producer sends the same number of msgs to every silk, round-robin) while the engine
+ * thread delivers them. the producers & the engine thread write different parts of the
+ * engine (the producer & consumer sides of the queue, the payload caches, etc) so this is
+ * where false sharing between them shows up. "make bench_mp" builds & runs it once per msg
+ * scheduler (SILK_SCHED__*), so the locked & the lock-free queues can be compared.
+ *
+ * We report the throughput (msgs/sec), the average cost of a msg & how many times the
+ * producers found the queue full. to count the cache-line transfers themselves, run it
+ * under e.g.: "perf stat -e cache-misses,LLC-load-misses" or "perf c2c record".
+ *
+ * Usage: bench_mp [num producers] [num msgs per producer per silk] [num silks] [msg queue size]
+ */
+
+#define _GNU_SOURCE // clock_gettime() & pthread_barrier_t
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include "silk.h"
+
+
+/*
+ * The application-speicifc msg the producers send to the silks
+ */
+#define SILK_MSG__APP_BENCH         SILK_MSG_APP_CODE_FIRST
+
+/*
+ * defaults for the CLI options
+ */
+#define BENCH_DEFAULT_NUM_PRODUCERS 4
+#define BENCH_DEFAULT_NUM_MSGS      (50 * 1000)
+#define BENCH_DEFAULT_NUM_SILKS     16
+#define BENCH_MAX_NUM_PRODUCERS     64
+
+/*
+ * the interval (in usec) the main thread waits for the silks to complete
+ */
+#define SLEEP_INTERVAL              1000
+
+struct silk_engine_t   engine;
+
+/*
+ * the number of msgs each silk receives & the number of silks that received all of them
+ */
+static uint64_t        num_msgs_per_silk;
+volatile int           num_silk_done = 0;
+
+/*
+ * the producers start together & count the times they found the queue full
+ */
+static pthread_barrier_t   start_barrier;
+static uint32_t            num_msgs_per_producer;
+static uint64_t            num_q_full[BENCH_MAX_NUM_PRODUCERS];
+
+/*
+ * give the CPU to the producers when the queue is empty
+ */
+static void
+bench_mp_idle_cb (struct silk_execution_thread_t   *exec_thr)
+{
+    sched_yield();
+}
+
+static uint64_t
+bench_now_nsec (void)
+{
+    struct timespec   ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+bench_mp_entry_func (void *_arg)
+{
+    struct silk_msg_t   msg;
+    uint64_t   i;
+
+    for (i = 0; i < num_msgs_per_silk; i++) {
+        silk_yield(&msg);
+        assert(msg.msg == SILK_MSG__APP_BENCH);
+    }
+    __sync_fetch_and_add(&num_silk_done, 1);
+}
+
+static void *
+bench_mp_producer (void *_arg)
+{
+    const int           producer = (int)(intptr_t)_arg;
+    struct silk_msg_t   msg = {
+        .msg = SILK_MSG__APP_BENCH,
+        .ctx = NULL,
+    };
+    uint64_t   q_full = 0;
+    uint32_t   i;
+    silk_id_t  silk_id;
+
+    pthread_barrier_wait(&start_barrier);
+    for (i = 0; i < num_msgs_per_producer; i++) {
+        for (silk_id = 0; silk_id < engine.cfg.num_silk; silk_id++) {
+            msg.silk_id = silk_id;
+            while (silk_send_msg(&engine, &msg) == SILK_STAT_Q_FULL) {
+                q_full++;
+                sched_yield();
+            }
+        }
+    }
+    num_q_full[producer] = q_full;
+    return NULL;
+}
+
+
+int main (int   argc, char **argv)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = 0,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = 16,
+        .num_stack_seperator_pages = 4,
+        .num_silk = BENCH_DEFAULT_NUM_SILKS,
+        .idle_cb = bench_mp_idle_cb,
+        .ctx = NULL,
+    };
+    pthread_t              producers[BENCH_MAX_NUM_PRODUCERS];
+    struct silk_t          *s;
+    enum silk_status_e     silk_stat;
+    uint64_t   start, end, total_msgs, total_q_full = 0;
+    int        num_producers = BENCH_DEFAULT_NUM_PRODUCERS;
+    int        i;
+
+
+    num_msgs_per_producer = BENCH_DEFAULT_NUM_MSGS;
+    if (argc > 1) {
+        num_producers = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        num_msgs_per_producer = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        silk_cfg.num_silk = atoi(argv[3]);
+    }
+    if (argc > 4) {
+        silk_cfg.msg_queue_size = atoi(argv[4]);
+    }
+    if ((num_producers < 1) || (num_producers > BENCH_MAX_NUM_PRODUCERS) ||
+        (num_msgs_per_producer < 1) || (silk_cfg.num_silk < 1)) {
+        printf("Usage: bench_mp [num producers (1-%d)] [num msgs per producer per silk] [num silks] "
+               "[msg queue size (a power of 2)]\n", BENCH_MAX_NUM_PRODUCERS);
+        return 1;
+    }
+    num_msgs_per_silk = (uint64_t)num_producers * num_msgs_per_producer;
+
+    silk_stat = silk_init(&engine, &silk_cfg);
+    if (silk_stat == SILK_STAT_INVALID_MSG_QUEUE_SIZE) {
+        printf("the msg queue size must be a power of 2 & at least twice the number of silks\n");
+        return 1;
+    }
+    assert(silk_stat == SILK_STAT_OK);
+    for (i = 0; i < silk_cfg.num_silk; i++) {
+        silk_stat = silk_alloc(&engine, bench_mp_entry_func, NULL, 0, &s);
+        assert(silk_stat == SILK_STAT_OK);
+        silk_stat = silk_dispatch(&engine, s);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, num_producers + 1);
+    for (i = 0; i < num_producers; i++) {
+        if (pthread_create(&producers[i], NULL, bench_mp_producer, (void*)(intptr_t)i) != 0) {
+            printf("failed to create producer %d (errno %d)\n", i, errno);
+            return 1;
+        }
+    }
+    pthread_barrier_wait(&start_barrier);
+    start = bench_now_nsec();
+    for (i = 0; i < num_producers; i++) {
+        pthread_join(producers[i], NULL);
+        total_q_full += num_q_full[i];
+    }
+    while (num_silk_done < silk_cfg.num_silk) {
+        sched_yield();
+    }
+    end = bench_now_nsec();
+    pthread_barrier_destroy(&start_barrier);
+
+    total_msgs = num_msgs_per_silk * silk_cfg.num_silk;
+    printf("%d producers, %d silks: %llu msgs in %.3f sec, %.0f msgs/sec, %.1f nsec/msg, %llu queue full\n",
+           num_producers, silk_cfg.num_silk, (unsigned long long)total_msgs,
+           (end - start) / 1e9, total_msgs * 1e9 / (end - start),
+           (double)(end - start) / total_msgs, (unsigned long long)total_q_full);
+
+    // let the last silks become free
+    while (engine.num_free_silk != engine.cfg.num_silk) {
+        usleep(SLEEP_INTERVAL);
+    }
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyight (C) Eitan Ben-Amos, 2012
+ *
+ * A micro-benchmark of the raw context-switch (i.e.: SILK_SWITCH) cost.
+ * unlike the timing done by ping_pong, no engine, msg queue or logging is involved:
+ * the main thread & N-1 silk contexts switch into each other in a ring, in a tight loop.
+ * The program is built once per context-switch backend (see the bench_switch make
+ * target) so the numbers of the different backends can be compared.
+ *
+ * The ring is timed with rdtsc for many runs & we report the min, median & 99th
+ * percentile of the cost of a single switch in cycles & in nanoseconds (the TSC
+ * frequency is calibrated against CLOCK_MONOTONIC on startup).
+ *
+ * Usage: bench_switch [num contexts (>= 2)] [num runs]
+ */
+
+#define _DEFAULT_SOURCE // MAP_STACK & clock_gettime()
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "config.h"
+#include "silk_context.h"
+
+
+/*
+ * the number of round-trips along the ring we time in a single run & the number of
+ * round-trips we do beforehand to warm-up the caches & branch predictors.
+ */
+#define BENCH_TRIPS_PER_RUN         (10 * 1000)
+#define BENCH_NUM_WARMUP_TRIPS      (100 * 1000)
+
+/*
+ * defaults for the CLI options
+ */
+#define BENCH_DEFAULT_NUM_CTX       2
+#define BENCH_DEFAULT_NUM_RUNS      500
+#define BENCH_MAX_NUM_CTX           64
+
+/*
+ * the stack size of each silk context we switch into
+ */
+#define BENCH_STACK_SIZE            (16 * 4096)
+
+/*
+ * the time we spend calibrating the TSC (nsec)
+ */
+#define BENCH_CALIBRATION_NSEC      (100 * 1000 * 1000)
+
+/*
+ * the name of the backend we were built with
+ */
+#if defined (SILK_CONTEXT__LIBC_NO_SIGMASK)
+#define BENCH_CONTEXT_NAME   "LIBC_NO_SIGMASK"
+#elif defined (SILK_CONTEXT__LIBC)
+#define BENCH_CONTEXT_NAME   "LIBC"
+#elif defined (SILK_CONTEXT__MINIMAL_INLINE)
+#define BENCH_CONTEXT_NAME   "MINIMAL_INLINE"
+#else
+#define BENCH_CONTEXT_NAME   "MINIMAL"
+#endif
+
+/*
+ * the contexts in the ring. #0 is the main thread.
+ */
+static struct silk_exec_state_t   ctx[BENCH_MAX_NUM_CTX];
+static int                        num_ctx = BENCH_DEFAULT_NUM_CTX;
+/*
+ * the index of the context currently running. set by the context switching out.
+ */
+static volatile int               cur_ctx = 0;
+
+
+static inline uint64_t
+bench__rdtsc (void)
+{
+    uint32_t   lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t
+bench__now_nsec (void)
+{
+    struct timespec   ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * estimate the TSC frequency (in cycles per nsec)
+ */
+static double
+bench__calibrate_tsc (void)
+{
+    uint64_t    start_nsec, end_nsec, start_tsc, end_tsc;
+
+    start_nsec = bench__now_nsec();
+    start_tsc = bench__rdtsc();
+    do {
+        end_nsec = bench__now_nsec();
+    } while (end_nsec - start_nsec < BENCH_CALIBRATION_NSEC);
+    end_tsc = bench__rdtsc();
+    return (double)(end_tsc - start_tsc) / (double)(end_nsec - start_nsec);
+}
+
+/*
+ * switch into the next context along the ring
+ */
+static inline void
+bench__switch_next (void)
+{
+    const int   me = cur_ctx;
+    const int   next = (me + 1 == num_ctx) ? 0 : me + 1;
+
+    cur_ctx = next;
+    SILK_SWITCH(ctx[next], ctx[me]);
+}
+
+/*
+ * the silk side of the ring. it just switches into the next context.
+ */
+static void
+bench__silk_main (void)
+{
+    do {
+        bench__switch_next();
+    } while (1);
+}
+
+static int
+bench__cmp_u64 (const void *a, const void *b)
+{
+    const uint64_t   x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+ __attribute__((noreturn)) static void usage ()
+{
+    printf("Usage: bench_switch [num contexts (2..%d)] [num runs]\n", BENCH_MAX_NUM_CTX);
+    exit(EINVAL);
+}
+
+
+int main (int   argc, char **argv)
+{
+    void       *stacks;
+    uint64_t   *run_cycles;
+    uint64_t    start;
+    double      cycles_per_nsec, min, median, p99;
+    int         num_runs = BENCH_DEFAULT_NUM_RUNS;
+    int         i, run;
+
+
+    // read CLI options
+    if (argc > 1) {
+        num_ctx = atoi(argv[1]);
+        if ((num_ctx < 2) || (num_ctx > BENCH_MAX_NUM_CTX)) {
+            usage();
+        }
+    }
+    if (argc > 2) {
+        num_runs = atoi(argv[2]);
+        if (num_runs < 1) {
+            usage();
+        }
+    }
+
+    run_cycles = calloc(num_runs, sizeof(*run_cycles));
+    stacks = mmap(NULL, (size_t)BENCH_STACK_SIZE * num_ctx, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if ((run_cycles == NULL) || (stacks == MAP_FAILED)) {
+        printf("ERROR: failed to allocate memory. errno=%d\n", errno);
+        exit(errno);
+    }
+    for (i = 1; i < num_ctx; i++) {
+        silk_create_initial_stack_context(&ctx[i], bench__silk_main,
+                                          (char*)stacks + (size_t)BENCH_STACK_SIZE * i,
+                                          BENCH_STACK_SIZE);
+    }
+    cycles_per_nsec = bench__calibrate_tsc();
+
+    for (i = 0; i < BENCH_NUM_WARMUP_TRIPS; i++) {
+        bench__switch_next();
+    }
+    for (run = 0; run < num_runs; run++) {
+        start = bench__rdtsc();
+        for (i = 0; i < BENCH_TRIPS_PER_RUN; i++) {
+            bench__switch_next();
+        }
+        run_cycles[run] = bench__rdtsc() - start;
+    }
+
+    // each round-trip along the ring is "num_ctx" switches
+    qsort(run_cycles, num_runs, sizeof(*run_cycles), bench__cmp_u64);
+    min = (double)run_cycles[0] / ((double)BENCH_TRIPS_PER_RUN * num_ctx);
+    median = (double)run_cycles[num_runs / 2] / ((double)BENCH_TRIPS_PER_RUN * num_ctx);
+    p99 = (double)run_cycles[(num_runs * 99) / 100] / ((double)BENCH_TRIPS_PER_RUN * num_ctx);
+    printf("%-16s: %d contexts, %d runs * %d switches, cycles per switch (min/median/p99) "
+           "%.1f/%.1f/%.1f, nsec per switch %.2f/%.2f/%.2f\n", BENCH_CONTEXT_NAME,
+           num_ctx, num_runs, BENCH_TRIPS_PER_RUN * num_ctx, min, median, p99,
+           min / cycles_per_nsec, median / cycles_per_nsec, p99 / cycles_per_nsec);
+    munmap(stacks, (size_t)BENCH_STACK_SIZE * num_ctx);
+    free(run_cycles);
+    return 0;
+}
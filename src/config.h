@@ -6,12 +6,69 @@
 #define __CONFIG_H__
 
 
+/*
+ * select a context-switch implementation. The selection can also be made from the
+ * make command line (e.g.: "make SILK_CONTEXT=LIBC"), in which case the defaults
+ * below are skipped.
+ */
+#if !defined (SILK_CONTEXT__LIBC) && !defined (SILK_CONTEXT__LIBC_NO_SIGMASK) && \
+    !defined (SILK_CONTEXT__MINIMAL) && !defined (SILK_CONTEXT__MINIMAL_INLINE)
+
 /* enables context-switch based on LIBC API's. */
 //#define SILK_CONTEXT__LIBC
 
+/*
+ * enables context-switch based on LIBC API's, without the syscall that swapcontext()
+ * makes on every switch to save/restore the signal mask. 
+ */
+//#define SILK_CONTEXT__LIBC_NO_SIGMASK
+
 /* enables context-switch based on internal assembly code */
 #define SILK_CONTEXT__MINIMAL
 
+/*
+ * enables context-switch based on internal assembly code, inlined into every
+ * call site so the compiler saves only the registers that are live there.
+ */
+//#define SILK_CONTEXT__MINIMAL_INLINE
+
+#endif
+
+/* the inlined variant is built on top of the MINIMAL one */
+#if defined (SILK_CONTEXT__MINIMAL_INLINE) && !defined (SILK_CONTEXT__MINIMAL)
+#define SILK_CONTEXT__MINIMAL
+#endif
+
+/* the sigmask-free variant is built on top of the LIBC one */
+#if defined (SILK_CONTEXT__LIBC_NO_SIGMASK) && !defined (SILK_CONTEXT__LIBC)
+#define SILK_CONTEXT__LIBC
+#endif
+
+/*
+ * the size (in bytes) of the payload a msg can carry inline (see silk_send_msg_inline()).
+ * every msg (in the queue & on the stack of each silk) grows by it, so it is opt-in: 0
+ * leaves the msgs with just a pointer to their payload & compiles the inline API out.
+ * 48 bytes keep a msg within a single 64 bytes cache line. can also be set from the make
+ * command line (e.g.: "make SILK_MSG_INLINE_SIZE=48").
+ */
+#ifndef SILK_MSG_INLINE_SIZE
+#define SILK_MSG_INLINE_SIZE    0
+#endif
+
+/*
+ * select a msg scheduler (the incoming msg queue of an engine). The selection can also be
+ * made from the make command line (e.g.: "make SILK_SCHED=MPSC").
+ */
+#if !defined (SILK_SCHED__VANILLA) && !defined (SILK_SCHED__MPSC)
+
+/* the producers serialize on a mutex, the consumer is lock-free */
+#define SILK_SCHED__VANILLA
+
+/* a lock-free multi-producer single-consumer ring */
+//#define SILK_SCHED__MPSC
+
+#endif
+
 /*
  * select a TLS implementation, whether pthreads or compiler support.
  */
@@ -5,7 +5,7 @@
  * open a connection & post msgs, reading the reply for each msg
  */
 
-#define _BSD_SOURCE
+#define _DEFAULT_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -53,10 +53,13 @@
 #include "echo_sample.h"
 
 /*
- * This is the number of Silk instance we'll have.
- * Note: This limits the number of connections we support !!!
+ * This is the number of Silk instance we start with & the number the pool may grow to
+ * (a chunk of ECHO_SERVER_GROW_CONN at a time) as connections are accepted.
+ * Note: The latter limits the number of connections we support !!!
  */
-#define ECHO_SERVER_MAX_CONN             20
+#define ECHO_SERVER_INITIAL_CONN         20
+#define ECHO_SERVER_MAX_CONN             512
+#define ECHO_SERVER_GROW_CONN            32
 
 /*
  * max backlog on accepting socket
@@ -79,9 +82,8 @@ struct options {
 
 
 /*
- * connection-private information. This shows that although a silk has no
- * Silk-Local-Storage (akin to Thread-Local-Storage), it can be easily provided
- * with a separate array of these object. Silk#N will use indec N of that array.
+ * connection-private information, kept in the Silk-Local-Storage (akin to
+ * Thread-Local-Storage) of the silk serving the connection, right after its control block.
  */
 struct conn_state_t {
     // the socket of the connection.
@@ -91,7 +93,7 @@ struct conn_state_t {
     // the currrent network msg (which might be recived in parts)
     struct echo_msg_t  net_msg;
 };
-static struct conn_state_t silk_local_stg[ECHO_SERVER_MAX_CONN];
+static silk_local_key_t   conn_key;
 
 /*
  * The Echo server state
@@ -208,7 +210,7 @@ echo_server_entry_func (void *_arg)
     struct silk_msg_t      msg;
     struct echo_msg_t      net_msg;
     uint16_t   text_len;
-    struct conn_state_t   *conn = &silk_local_stg[s->silk_id];
+    struct conn_state_t   *conn = silk_local(conn_key);
 
 
     printf("Silk#%d starting to serve client %s\n", s->silk_id, 
@@ -294,11 +296,16 @@ echo_server_idle_cb (struct silk_execution_thread_t   *exec_thr)
                                inet_ntoa(client_addr.sin_addr),
                                client_addr.sin_port);
                         // allocate a new silk to serve the new connection
-                        silk_stat = silk_alloc(&engine, echo_server_entry_func, (void*)new_conn, &s);
+                        silk_stat = silk_alloc(&engine, echo_server_entry_func, (void*)(intptr_t)new_conn, 0, &s);
+                        if (silk_stat == SILK_STAT_NO_FREE_SILK) {
+                            printf("ERROR: too many connections. closing the new one\n");
+                            close(new_conn);
+                            continue;
+                        }
                         assert(silk_stat == SILK_STAT_OK);
                         SILK_DEBUG("allocated silk No %d", s->silk_id);
                         // copy connection info/state into silk-local-storage
-                        struct conn_state_t   *conn = &silk_local_stg[s->silk_id];
+                        struct conn_state_t   *conn = silk_get_local(s, conn_key);
                         conn->sock = new_conn;
                         conn->client_addr = client_addr;
                         add_sock_to_fdset(new_conn);
@@ -330,11 +337,13 @@ static void usage ()
 int main (int   argc, char **argv)
 {
     static struct silk_engine_param_t    silk_cfg = {
-        .flags = 0,
+        .flags = SILK_CFG_FLAG_POOL_SHRINK,
         .stack_addr = (void*)0xb0000000,
         .num_stack_pages = 16,
         .num_stack_seperator_pages = 4,
-        .num_silk = ECHO_SERVER_MAX_CONN,
+        .num_silk = ECHO_SERVER_INITIAL_CONN,
+        .max_silk = ECHO_SERVER_MAX_CONN,
+        .num_grow_silks = ECHO_SERVER_GROW_CONN,
         .idle_cb = echo_server_idle_cb,
         .ctx = NULL,
     };
@@ -364,7 +373,8 @@ int main (int   argc, char **argv)
     echo_server.max_fd = 0;
     memset(map_fd_2_silk_id, 0xff, sizeof(map_fd_2_silk_id)); // poison mapping
 
-    // initialize our Silk engine
+    // initialize our Silk engine, with the state of a connection in each silk
+    conn_key = silk_local_key_register(&silk_cfg, sizeof(struct conn_state_t));
     silk_stat = silk_init(&engine, &silk_cfg);
     SILK_DEBUG("Silk initialization returns:%d", silk_stat);
 
@@ -38,6 +38,7 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <assert.h>
 #define __USE_XOPEN_EXTENDED
@@ -71,6 +72,8 @@ bool    *rcv_msg_flags = NULL;
  */
 struct options {
     int    num_silk;
+    int    num_seperator_pages;
+    bool   huge_pages;
 } opt;
 
 struct silk_engine_t   engine;
@@ -133,16 +136,10 @@ ping_pong_entry_func (void *_arg)
     struct silk_t                 *s = silk__my_ctrl();
     struct silk_msg_t              msg;
     struct ping_pong_msg_info_t   *rx_msg_info;
-    struct ping_pong_msg_info_t    tx_msg_info = {
-        .msg_src = s->silk_id,
-    };
-    struct silk_msg_t              tx_msg = {
-        .msg = SILK_MSG__APP_PING_PONG,
-        .ctx = &tx_msg_info,
-    };
+    struct ping_pong_msg_info_t   *tx_msg_info;
     silk_id_t           exp_msg_originator, msg_originator, msg_target;
     enum silk_status_e  silk_stat;
-    int arg = (int)_arg;
+    int arg = (int)(intptr_t)_arg;
     int msg_cntr;
     
 
@@ -157,9 +154,13 @@ ping_pong_entry_func (void *_arg)
         if (msg_cntr < opt.num_silk) {
             SILK_DEBUG("Silk#%d sending msg to Silk#%d",
                        s->silk_id, msg_target);
-            tx_msg_info.msg_count = msg_cntr;
-            tx_msg.silk_id = msg_target;
-            silk_stat = silk_send_msg(&engine, &tx_msg);
+            // the payload is freed once the target is done with it
+            tx_msg_info = silk_payload_alloc(&engine);
+            assert(tx_msg_info != NULL);
+            tx_msg_info->msg_src = s->silk_id;
+            tx_msg_info->msg_count = msg_cntr;
+            silk_stat = silk_send_msg_payload(&engine, SILK_MSG__APP_PING_PONG, msg_target,
+                                              tx_msg_info);
             assert(silk_stat == SILK_STAT_OK);
         }
         SILK_DEBUG("Silk#%d expecting msg from Silk#%d",
@@ -190,7 +191,7 @@ ping_pong_entry_func (void *_arg)
 
  __attribute__((noreturn)) static void usage ()
 {
-    printf("Usage: ping_pong <num silks>\n");
+    printf("Usage: ping_pong <num silks> [<num separator pages> [huge]]\n");
     exit(EINVAL);
 }
 
@@ -216,6 +217,7 @@ int main (int   argc, char **argv)
 
     // set CLI defaults
     opt.num_silk = DEFAULT_NUM_SILKS;
+    opt.num_seperator_pages = silk_cfg.num_stack_seperator_pages;
 
     // read CLI options 
     if (argc > 1) {
@@ -225,16 +227,36 @@ int main (int   argc, char **argv)
                 usage();
             }
         }
+        if (argc >= 3) {
+            opt.num_seperator_pages = atoi(argv[2]);
+            if (opt.num_seperator_pages < 0) {
+                usage();
+            }
+        }
+        // back the stacks & silks with huge pages (SILK_CFG_FLAG_HUGE_PAGES)
+        if (argc >= 4) {
+            if (strcmp(argv[3], "huge") != 0) {
+                usage();
+            }
+            opt.huge_pages = true;
+        }
     }
 
     // allocate flags matrix
     rcv_msg_flags = calloc(opt.num_silk * opt.num_silk, sizeof(*rcv_msg_flags));
     SILK_DEBUG("Initializing Silk engine...");
     silk_cfg.num_silk = opt.num_silk;
+    // each silk has at most one msg on the way to the next & one being processed
+    silk_cfg.payload_size = sizeof(struct ping_pong_msg_info_t);
+    silk_cfg.num_payloads = 2 * opt.num_silk + SILK_PAYLOAD_CACHE_SIZE;
+    silk_cfg.num_stack_seperator_pages = opt.num_seperator_pages;
+    if (opt.huge_pages) {
+        silk_cfg.flags |= SILK_CFG_FLAG_HUGE_PAGES;
+    }
     silk_stat = silk_init(&engine, &silk_cfg);
     SILK_DEBUG("Silk initialization returns:%d", silk_stat);
     for (i=0; i < opt.num_silk; i++) {
-        silk_stat = silk_alloc(&engine, ping_pong_entry_func, (void*)i, &s);
+        silk_stat = silk_alloc(&engine, ping_pong_entry_func, (void*)(intptr_t)i, 0, &s);
         assert(silk_stat == SILK_STAT_OK);
         SILK_DEBUG("allocated silk No %d", s->silk_id);
         silk_stat = silk_dispatch(&engine, s);
@@ -54,7 +54,7 @@ run_n__entry_func (void *_arg)
 {
     struct silk_t                  *s = silk__my_ctrl();
     struct silk_msg_t   msg;
-    int arg = (int)_arg;
+    int arg = (int)(intptr_t)_arg;
     int stk_var;
     int msg_cntr;
     
@@ -122,7 +122,7 @@ int main (int   argc, char **argv)
     silk_stat = silk_init(&engine, &silk_cfg);
     printf("Silk initialization returns:%d\n", silk_stat);
     for (i=0; i < num_silk; i++) {
-        silk_stat = silk_alloc(&engine, run_n__entry_func, (void*)i, &s);
+        silk_stat = silk_alloc(&engine, run_n__entry_func, (void*)(intptr_t)i, 0, &s);
         assert(silk_stat == SILK_STAT_OK);
         printf("allocacated silk No %d\n", s->silk_id);
         silk_stat = silk_dispatch(&engine, s);
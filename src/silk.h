@@ -40,6 +40,16 @@ struct silk_engine_t;
  */
 typedef void (*silk_engine_idle_callback_t) (struct silk_execution_thread_t   *silk_thread);
 
+/*
+ * a class of silks which have the same stack size.
+ */
+struct silk_stack_class_param_t {
+    // The number of 4KB pages for a stack of each silk in the class.
+    uint32_t             num_stack_pages;
+    // The number of silk instances in the class
+    uint32_t             num_silk;
+};
+
 /*
  * information to create a Silk processing entity.
  */
@@ -47,14 +57,153 @@ struct silk_engine_param_t {
     // flags controling various behaviors
     int32_t              flags;
 #define SILK_CFG_FLAG_LOCK_STACK_MEM    0x01
+/*
+ * the policy for committing memory to the silk stacks. by default all the stack pages
+ * are populated on silk_init() so no page-fault is taken at run-time.
+ * LAZY - commit pages on first touch & dont reserve swap for them (MAP_NORESERVE),
+ *        so only the stack depth actually used consumes memory.
+ * TOP - populate only the top "num_stack_commit_pages" pages of each stack (where
+ *       every silk runs most of the time). the rest are committed on first touch.
+ */
+#define SILK_CFG_FLAG_STACK_COMMIT_LAZY 0x02
+#define SILK_CFG_FLAG_STACK_COMMIT_TOP  0x04
+#define SILK_CFG_FLAG_STACK_COMMIT_MASK (SILK_CFG_FLAG_STACK_COMMIT_LAZY | SILK_CFG_FLAG_STACK_COMMIT_TOP)
+/*
+ * the policy for returning stack pages to the OS when silks are freed. the free list is
+ * LIFO so the first "num_warm_free_silks" silks on it are likely to be reused soon &
+ * keep their stacks. whenever a silk is pushed to the free list, the silk it pushes
+ * beyond that point has its stack pages below the top "num_stack_keep_pages" released.
+ * RELEASE - release using MADV_DONTNEED (the RSS drops immediately).
+ * RELEASE_LAZY - release using MADV_FREE (the kernel reclaims the pages only under
+ *                memory pressure, which is cheaper if they are reused).
+ */
+#define SILK_CFG_FLAG_STACK_RELEASE      0x08
+#define SILK_CFG_FLAG_STACK_RELEASE_LAZY 0x10
+#define SILK_CFG_FLAG_STACK_RELEASE_MASK (SILK_CFG_FLAG_STACK_RELEASE | SILK_CFG_FLAG_STACK_RELEASE_LAZY)
+/*
+ * profile the stack usage (high-water-mark) of the silks. the unused part of each stack
+ * is painted with a known pattern when the silk boots (or is recycled) & every time its
+ * entry function returns, so the deepest byte used is found when the silk exits (or is
+ * killed). see silk_stack_profile_get().
+ * This is a diagnostic mode to tune the stack size: painting touches every stack page
+ * (so it defeats the commit policies) & it cant be used with a release policy.
+ */
+#define SILK_CFG_FLAG_STACK_PROFILE      0x20
+/*
+ * run the silks on "num_run_stacks" shared run stacks rather than a stack per silk.
+ * a silk that is switched-out keeps its frames on its run stack until another silk of
+ * the same run stack is switched-in. only then the live part of its stack (usually a
+ * few hundred bytes) is copied to a per-silk save buffer, & copied back when the silk
+ * is switched-in again. This trades a memcpy() on some of the switches for the memory
+ * of a stack per silk, for engines with huge populations of mostly idle silks.
+ * The silks find themselves through the execution thread rather than by their stack
+ * address, so BEWARE of pointers to stack variables: they are valid only while the silk
+ * runs. it cant be used with stack classes, a release policy or stack profiling.
+ */
+#define SILK_CFG_FLAG_SHARED_STACK       0x40
+/*
+ * hibernate silks which wait for a msg for longer than "hibernate_msec": the live part
+ * of the stack is copied to a heap buffer & the stack pages are released (MADV_DONTNEED).
+ * the stack is restored when a msg for the silk is popped. The idle processing looks for
+ * such silks (a few on each pass), so a busy engine doesnt hibernate silks.
+ * it cant be used with shared run stacks, locked stack memory or stack profiling.
+ */
+#define SILK_CFG_FLAG_HIBERNATE          0x80
+/*
+ * handle stack overflows. the separator pages below each stack (& below the first one)
+ * are its guard. when a silk faults on its guard, a SIGSEGV handler (running on an
+ * alternate signal stack) reports the silk & recycles it just like a killed silk, rather
+ * than letting the process crash. any other fault is passed on to the previous handler.
+ * BEWARE: a frame larger than the guard can skip over it into the next stack.
+ */
+#define SILK_CFG_FLAG_STACK_GUARD        0x100
+/*
+ * back the stack area & the silk control array with huge pages to cut the dTLB misses
+ * of switching among many silks. hugetlbfs pages (MAP_HUGETLB) are used when the stacks
+ * have no separator pages & no release/hibernation policy (they can only be protected &
+ * released as a whole). otherwise, or when no hugetlbfs pages are reserved, the areas are
+ * advised as transparent huge pages (MADV_HUGEPAGE). the separator pages split the stack
+ * area into a mapping per stack, so set num_stack_seperator_pages to 0 to trade the
+ * guards for huge pages. when neither is available, regular pages are used.
+ */
+#define SILK_CFG_FLAG_HUGE_PAGES         0x200
+/*
+ * place the engine on the NUMA node "numa_node": the memory of the stacks, the silks array
+ * & the msg queue is bound to the node (pages which were already touched, such as the
+ * queue embedded in the engine, are moved there) & the engine thread runs only on the
+ * CPUs of the node. silk_init() fails on a node without CPUs.
+ */
+#define SILK_CFG_FLAG_NUMA_BIND          0x400
+/*
+ * shrink a pool which grew (see "max_silk"): the idle processing releases the top chunk
+ * of silks (the stacks, control blocks & arenas go back to the OS) once all of them are
+ * free & enough other silks are free, so the pool is sized for the average load rather
+ * than the peak. it never shrinks below the "num_silk" silks booted by silk_init().
+ * it cant be used with locked stack memory.
+ * BEWARE: the silk IDs of the released silks are invalid until the pool grows again.
+ */
+#define SILK_CFG_FLAG_POOL_SHRINK        0x800
     // Initial address of the stack area. set NULL for the library to provide
     void                 *stack_addr;
     // The number of 4KB pages for a stack of each silk.
     uint32_t             num_stack_pages;
-    // The number if 4KB pages to separate between consecutive silk stack buffers
+    // The number of 4KB pages to populate at the top of each stack (SILK_CFG_FLAG_STACK_COMMIT_TOP)
+    uint32_t             num_stack_commit_pages;
+    /*
+     * The number of 4KB pages at the top of each stack that are never released
+     * (SILK_CFG_FLAG_STACK_RELEASE*). must cover the frames of a free silk (i.e.:
+     * silk__main() & silk_yield()) so at least 1.
+     */
+    uint32_t             num_stack_keep_pages;
+    // The number of silks at the head of the free list whose stacks are not released (at least 1).
+    uint32_t             num_warm_free_silks;
+    // The number if 4KB pages to separate between consecutive silk stack buffers (& below the first one)
     uint32_t             num_stack_seperator_pages;
     // The number of silk instance to create
     uint32_t             num_silk;
+    // The number of run stacks shared by all silks (SILK_CFG_FLAG_SHARED_STACK)
+    uint32_t             num_run_stacks;
+    // The time (msec) a silk waits for a msg before it is hibernated (SILK_CFG_FLAG_HIBERNATE)
+    uint32_t             hibernate_msec;
+    // The NUMA node the engine runs on (SILK_CFG_FLAG_NUMA_BIND)
+    uint32_t             numa_node;
+    // The number of 4KB pages of the scratch memory arena of each silk (see silk_arena_alloc())
+    uint32_t             num_arena_pages;
+    // The size (in bytes) & the number of the msg payloads in the pool (see silk_payload_alloc())
+    uint32_t             payload_size;
+    uint32_t             num_payloads;
+    /*
+     * The maximal number of silks the pool grows to when silk_alloc() finds no free silk,
+     * "num_grow_silks" silks at a time (0 for SILK_DFLT_GROW_SILKS). 0 keeps the pool at
+     * "num_silk". the address space of their control blocks is reserved by silk_init() &
+     * committed when the pool grows. their stacks are reserved in segments of
+     * SILK_STACK_SEG_SILKS stacks as the pool grows into them (regular pages, even with
+     * SILK_CFG_FLAG_HUGE_PAGES). a grown silk isnt booted by msgs: it starts when the first
+     * msg for it is popped, so a large pool is better booted small & grown.
+     * it cant be used with stack size classes or shared run stacks.
+     */
+    uint32_t             max_silk;
+    uint32_t             num_grow_silks;
+    /*
+     * The size (in bytes) of the silk-local storage of each silk, which is kept right after
+     * its control block. it is set by registering the slots (see silk_local_key_register()).
+     */
+    uint32_t             local_size;
+    /*
+     * The number of msgs the msg queue can hold (a power of 2). booting each silk takes 2
+     * msgs & a grown silk takes a BOOT msg whenever it is recycled, so it must be at least
+     * twice "max_silk". 0 for SILK_DFLT_MSG_QUEUE_SIZE, or the power of 2 that boots all
+     * silks the pool may grow to if thats larger.
+     */
+    uint32_t             msg_queue_size;
+    /*
+     * optional stack size classes, ordered by ascending stack size. when set,
+     * "num_stack_pages" is ignored & "num_silk" is set to the total of all classes.
+     * the class is selected on silk_alloc() (see SILK_ALLOC_FLAG__STACK_CLASS()).
+     * when "num_stack_classes" is 0, all silks have "num_stack_pages" pages.
+     */
+    uint32_t                            num_stack_classes;
+    struct silk_stack_class_param_t     stack_classes[SILK_MAX_STACK_CLASSES];
     // the callback function to be called when the engine has nothing to do (i.e.: no msgs to process)
     silk_engine_idle_callback_t         idle_cb;
     // a context to be attached by the application to the Silk execution object
@@ -84,30 +233,87 @@ struct silk_engine_param_t {
 // extract the state of a silk instance
 #define SILK_STATE(s)   ((s)->state & SILK_STATE__MASK)
 
+/*
+ * flags given to silk_alloc(). These are kept in the silk state (above the state bits)
+ * for the lifetime of the allocation.
+ */
+// preserve the x87 control word & MXCSR (e.g.: rounding mode) across context-switches
+#define SILK_ALLOC_FLAG__FPU_CTRL    0x100
+// preserve the whole x87/MMX/SSE/AVX state (fxsave/xsave) across context-switches
+#define SILK_ALLOC_FLAG__FPU_FULL    0x200
+#define SILK_ALLOC_FLAG__FPU_MASK    (SILK_ALLOC_FLAG__FPU_CTRL | SILK_ALLOC_FLAG__FPU_FULL)
+#define SILK_ALLOC_FLAG__MASK        0xff00
+/*
+ * the smallest stack class the silk may get. when there is no free silk in that class,
+ * a silk of a larger class is allocated. it isnt kept in the silk state.
+ */
+#define SILK_ALLOC_FLAG__STACK_CLASS_SHIFT  16
+#define SILK_ALLOC_FLAG__STACK_CLASS_MASK   (0x3 << SILK_ALLOC_FLAG__STACK_CLASS_SHIFT)
+#define SILK_ALLOC_FLAG__STACK_CLASS(c)     ((c) << SILK_ALLOC_FLAG__STACK_CLASS_SHIFT)
+
 
 /*
  * a single silk uthread instance
  */
 struct silk_t {
-    // the link-list chaining object
-    SLIST_ENTRY(silk_t)           next_free;
-    // the entry function of the silk thread
-    silk_uthread_func_t           entry_func;
-    // an argument to be passed to the silk entry point
-    void                         *entry_func_arg;
+    /*
+     * the hot part, touched by the engine thread on every msg delivered to the silk &
+     * every context-switch. it is kept on the first cache line of the silk.
+     */
     // the context saved during the last run.
     struct silk_exec_state_t      exec_state;
-    // The silk processing instance that this thread serves
-    //struct silk_engine_t        engine;
+    // the floating-point state, for silks allocated with SILK_ALLOC_FLAG__FPU_*
+    struct silk_fpu_state_t      *fpu;
+    // the payload of the last msg the silk received, freed when it yields again
+    void                         *msg_payload;
+    /*
+     * SILK_CFG_FLAG_SHARED_STACK/SILK_CFG_FLAG_HIBERNATE: the stack pointer (minus the
+     * space used by the context switch) when the silk was last switched-out.
+     * a silk with "stack_fresh" set starts from the boot frame of its run stack.
+     */
+    void                         *stack_sp;
+    // when the silk was last switched-out (msec) & whether it is hibernated (SILK_CFG_FLAG_HIBERNATE)
+    uint64_t                      last_run_msec;
     /*
      * the state of this silk
-     * 2 bits : current state of silk object
+     * 3 bits : current state of silk object (SILK_STATE__*)
+     * 8 bits : flags of the current allocation (SILK_ALLOC_FLAG__*)
      * the silk is either transitions from FREE->ALLOC->RUN->TERM->FREE & at each
      * point only ne can touch it so no need to lock access.
      */
     uint32_t                      state;
     // the unique silk_id of this instance
     silk_id_t                     silk_id;
+    // the number of bytes allocated from the arena of the silk (see silk_arena_alloc())
+    uint32_t                      arena_used;
+    // the stack size class of the silk
+    uint8_t                       stack_class;
+    // whether the stack pages were released since the silk last ran
+    bool                          stack_released;
+    bool                          stack_fresh;
+    bool                          hibernated;
+    /*
+     * the cold part. "next_free" is written by the threads which allocate silks, so it
+     * is kept off the line the engine thread writes on every run of the silk.
+     */
+    // the link-list chaining object
+    SLIST_ENTRY(silk_t)           next_free SILK_CACHE_ALIGNED;
+    // the entry function of the silk thread
+    silk_uthread_func_t           entry_func;
+    // an argument to be passed to the silk entry point
+    void                         *entry_func_arg;
+    /*
+     * SILK_CFG_FLAG_SHARED_STACK/SILK_CFG_FLAG_HIBERNATE: the buffer the live stack part
+     * of the silk is saved in when another silk takes over its run stack (or when it is
+     * hibernated).
+     */
+    void                         *stack_save_buf;
+    uint32_t                      stack_save_len;
+    uint32_t                      stack_save_size;
+    // the deepest stack usage (in bytes) of all runs of the silk (SILK_CFG_FLAG_STACK_PROFILE)
+    uint32_t                      stack_max_depth;
+    // the silk was added when the pool grew & hasnt run yet (see silk__main())
+    bool                          lazy_boot;
 };
 
 static inline void 
@@ -118,6 +324,18 @@ silk__set_state(struct silk_t   *s,
     s->state = (s->state & ~SILK_STATE__MASK) | new_state;
 }
 
+/*
+ * a cache of free msg payloads, so a thread doesnt lock the pool for each payload.
+ * the caches shared by the threads which send msgs are locked (see silk_payload_alloc()).
+ * each cache starts on a cache line of its own, so threads using adjacent caches dont
+ * slow each other down.
+ */
+struct silk_payload_cache_t {
+    pthread_mutex_t                    mtx;
+    uint32_t                           num;
+    void                               *payload[SILK_PAYLOAD_CACHE_SIZE];
+} SILK_CACHE_ALIGNED;
+
 /*
  * Information related to the Silk engine thread (e.g.: pthread, etc) which is used to 
  * actually execute the micro-threads
@@ -135,6 +353,21 @@ struct silk_execution_thread_t {
     struct silk_exec_state_t           exec_state;
     // the current msg we are reading or that is being processed
     struct silk_msg_t                  last_msg;
+    // the FPU control words the thread started with, used by silks not preserving the FPU state.
+    struct silk_fpu_ctrl_t             fpu_dflt;
+    /*
+     * SILK_CFG_FLAG_SHARED_STACK: the switcher context which copies the stacks of silks
+     * sharing a run stack (on a stack of its own), along with the silk it should switch into.
+     * (the silk currently running is in TLS, see silk__my_cur_silk())
+     */
+    struct silk_exec_state_t           switcher_state;
+    struct silk_t                      *switch_to;
+    // the alternate signal stack for handling stack overflows (SILK_CFG_FLAG_STACK_GUARD)
+    void                               *alt_stack;
+    // a silk which overflowed its stack, until it is recycled (SILK_CFG_FLAG_STACK_GUARD)
+    struct silk_t                      *overflow_silk;
+    // the msg payloads freed & allocated by the silks (never locked)
+    struct silk_payload_cache_t        payload_cache;
 };
 
 /*
@@ -142,33 +375,254 @@ struct silk_execution_thread_t {
 */
 SLIST_HEAD(silk_head_t, silk_t);
 
+/*
+ * the kind of pages backing an area of the engine (SILK_CFG_FLAG_HUGE_PAGES)
+ */
+enum silk_huge_page_e {
+    SILK_HUGE_PAGE_NONE = 0,
+    // transparent huge pages (MADV_HUGEPAGE)
+    SILK_HUGE_PAGE_THP,
+    // hugetlbfs pages (MAP_HUGETLB)
+    SILK_HUGE_PAGE_HUGETLB,
+};
+
+/*
+ * the silks of one stack size class. they have consecutive silk IDs & their stacks
+ * are consecutive in the stack area, so the silk ID of a stack address is found by
+ * looking up the class which contains it.
+ */
+struct silk_stack_class_t {
+    // the lower address of the stack of the first silk of the class
+    void                                   *stack_addr;
+    // The size (in bytes) of a single stack, with & without the separator pages
+    size_t                                 padded_stack_size;
+    size_t                                 stack_size;
+    // The number of 4KB pages for a stack
+    uint32_t                               num_stack_pages;
+    // the silk IDs of the class are [first_silk_id, first_silk_id + num_silk)
+    silk_id_t                              first_silk_id;
+    uint32_t                               num_silk;
+    /*
+     * a list of free silk objects of this class. it is changed by the threads which
+     * allocate silks, so it doesnt share a cache line with the fields above (which the
+     * engine thread reads to find the silk of a stack address).
+     */
+    struct silk_head_t                     free_silks SILK_CACHE_ALIGNED;
+    // the deepest stack usage (in bytes) of all silks of the class (SILK_CFG_FLAG_STACK_PROFILE)
+    uint32_t                               stack_max_depth;
+};
+
+/*
+ * the number of bytes at the top of a run stack which hold the boot frame of a silk
+ * (SILK_CFG_FLAG_SHARED_STACK)
+ */
+#define SILK_SHARED_STACK_BOOT_SIZE    256
+
+/*
+ * a stack shared by the silks whose silk ID modulo the number of run stacks is its index
+ * (SILK_CFG_FLAG_SHARED_STACK).
+ */
+struct silk_run_stack_t {
+    // the lower address of the stack
+    void                                   *stack_addr;
+    // the silk whose frames are on the stack (NULL if none)
+    struct silk_t                          *owner;
+    // the initial context of a silk that starts to run on the stack & its boot frame
+    struct silk_exec_state_t               boot_state;
+    char                                   boot_image[SILK_SHARED_STACK_BOOT_SIZE];
+};
+
+/*
+ * the stack usage of all the runs of an entry function (SILK_CFG_FLAG_STACK_PROFILE)
+ */
+struct silk_stack_profile_t {
+    silk_uthread_func_t                    entry_func;
+    // the number of times a silk exited (or was killed) while running the function
+    uint64_t                               num_exits;
+    // the deepest stack usage (in bytes) & the total of all exits (for the average)
+    uint32_t                               max_depth;
+    uint64_t                               total_depth;
+};
+
  
 /*
- * A processing engine with a single thread
+ * A processing engine with a single thread.
+ * the fields are grouped by the threads which write them & each group starts on a cache
+ * line of its own, so a thread sending msgs (or allocating silks) doesnt invalidate the
+ * lines the engine thread works on. an engine allocated from the heap must therefore be
+ * aligned to SILK_CACHE_LINE_SIZE (e.g.: posix_memalign(), since malloc() only aligns to
+ * 16 bytes). silk_init() fails with SILK_STAT_ENGINE_MISALIGNED otherwise.
  */
 struct silk_engine_t {
-    // a mutex to guard access to engine state
-    pthread_mutex_t                        mtx;
-    // the thread which actually runs all silks
-    struct silk_execution_thread_t         exec_thr;
-    // msgs which are pending processing
-    struct silk_incoming_msg_queue_t       msg_sched;
+    /*
+     * read-mostly: set by silk_init() & only read afterwards, by all threads
+     */
+    // the configuration we started with
+    struct silk_engine_param_t             cfg;
     // the memory area used as stack for the uthreads
     void                                   *stack_addr;
+    size_t                                 stack_area_size;
+    // the stack size classes (a single one unless configured otherwise)
+    uint32_t                               num_stack_classes;
     // the state of each silk instance, inc. the context-switch
     struct silk_t                          *silks;
-    // the configuration we started with
-    struct silk_engine_param_t             cfg;
-    // a list of free silk objects
-    struct silk_head_t                     free_silks;
+    // the size of the area to save the full FPU state (SILK_ALLOC_FLAG__FPU_FULL)
+    size_t                                 fpu_area_size;
+    // the run stacks (SILK_CFG_FLAG_SHARED_STACK)
+    uint32_t                               num_run_stacks;
+    struct silk_run_stack_t                *run_stack;
+    // the pages backing the stack area & the silks array (SILK_CFG_FLAG_HUGE_PAGES)
+    enum silk_huge_page_e                  stack_huge_page;
+    enum silk_huge_page_e                  silks_huge_page;
+    // the size of the mapping of the silks array (0 when it is allocated from the heap)
+    size_t                                 silks_area_size;
+    // the scratch memory arenas of the silks (one after the other) & the size of each
+    void                                   *arena_addr;
+    size_t                                 arena_size;
+    // the msg payloads (each padded to SILK_PAYLOAD_ALIGN)
+    void                                   *payload_addr;
+    size_t                                 payload_padded_size;
+    // the number of silks booted by silk_init(). "cfg.num_silk" is the current size of the pool
+    uint32_t                               num_boot_silk;
+    // the size of a silk control block with its silk-local storage (padded to a cache line)
+    size_t                                 silk_size;
+    /*
+     * the stacks of the silks added when the pool grows are not in the stack area: they are
+     * reserved in segments of SILK_STACK_SEG_SILKS stacks as the pool grows into them. each
+     * segment is aligned to its size (a power of 2) & starts with a header page, so the silk
+     * of a stack address is still found in O(1). a NULL entry is a segment not reserved.
+     */
+    uint32_t                               num_stack_segs;
+    size_t                                 stack_seg_size;
+    void                                   **stack_seg;
+
+    /*
+     * shared: guarded by the mutex & written by both the engine thread & the threads
+     * which allocate silks or payloads
+     */
+    // a mutex to guard access to engine state
+    pthread_mutex_t                        mtx SILK_CACHE_ALIGNED;
     // indicate when the thread should terminate itself.
     bool                                   terminate;
     // The number of Silks in free state
     uint32_t                               num_free_silk;
+    // the list of free msg payloads (linked through their first word)
+    void                                   *payload_free;
+    uint32_t                               num_free_payload;
+    // the stack size classes (their free lists are on cache lines of their own)
+    struct silk_stack_class_t              stack_class[SILK_MAX_STACK_CLASSES];
+    // The number of times the pool grew & shrank (see "max_silk" & SILK_CFG_FLAG_POOL_SHRINK)
+    uint64_t                               num_pool_grow;
+    uint64_t                               num_pool_shrink;
+
+    /*
+     * private to the engine thread
+     */
+    // the thread which actually runs all silks
+    struct silk_execution_thread_t         exec_thr SILK_CACHE_ALIGNED;
+    // The number of times the stack pages of a free silk were released (SILK_CFG_FLAG_STACK_RELEASE*)
+    uint64_t                               num_stack_release;
+    /*
+     * the stack usage per entry function (SILK_CFG_FLAG_STACK_PROFILE). exits of functions
+     * beyond the first SILK_STACK_PROFILE_MAX_FUNCS are only counted.
+     */
+    uint32_t                               num_stack_profile;
+    struct silk_stack_profile_t            stack_profile[SILK_STACK_PROFILE_MAX_FUNCS];
+    uint64_t                               num_stack_profile_overflow;
+    /*
+     * The number of times (& bytes) the stack of a silk was saved & restored
+     * (SILK_CFG_FLAG_SHARED_STACK & SILK_CFG_FLAG_HIBERNATE)
+     */
+    uint64_t                               num_stack_save;
+    uint64_t                               num_stack_restore;
+    uint64_t                               stack_save_bytes;
+    /*
+     * the next silk the idle processing checks for hibernation & the number of times
+     * silks were hibernated & woken-up (SILK_CFG_FLAG_HIBERNATE)
+     */
+    silk_id_t                              hibernate_cursor;
+    uint64_t                               num_hibernate;
+    uint64_t                               num_wakeup;
+    // The number of silks recycled bcz they overflowed their stack (SILK_CFG_FLAG_STACK_GUARD)
+    uint64_t                               num_stack_overflow;
+    // The number of msgs dropped bcz their silk was released when the pool shrank
+    uint64_t                               num_stale_msg;
+
+    // msgs which are pending processing (its producer & consumer sides are on separate lines)
+    struct silk_incoming_msg_queue_t       msg_sched;
+    // the payload caches of the threads which send msgs (one cache line each at least)
+    struct silk_payload_cache_t            payload_cache[SILK_PAYLOAD_NUM_CACHES];
 };
 
+/*
+ * return the current size of the pool. it changes when the pool grows (by any thread
+ * allocating a silk) or shrinks, so it is published (release) only once the control blocks
+ * of the grown silks are initialized & read with acquire.
+ */
+static inline uint32_t
+silk_get_num_silk(struct silk_engine_t   *engine)
+{
+    return __atomic_load_n(&engine->cfg.num_silk, __ATOMIC_ACQUIRE);
+}
+
 // verify that a silk ID is valid.
-#define SILK_ASSERT_ID(engine, silk_id)   assert((silk_id) < (engine)->cfg.num_silk)
+#define SILK_ASSERT_ID(engine, silk_id)   assert((silk_id) < silk_get_num_silk(engine))
+/*
+ * return the address of the control block of a silk (each is followed by its silk-local
+ * storage). the ID isnt verified, so it can point at the end of the pool.
+ */
+static inline struct silk_t *
+silk__ctrl_addr(struct silk_engine_t   *engine,
+                silk_id_t              silk_id)
+{
+    return (struct silk_t *)((char *)engine->silks + (size_t)silk_id * engine->silk_size);
+}
+
+static inline struct silk_t *
+silk_get_ctrl_from_id(struct silk_engine_t   *engine,
+                      silk_id_t              silk_id)
+{
+    SILK_ASSERT_ID(engine, silk_id);
+    return silk__ctrl_addr(engine, silk_id);
+}
+
+/*
+ * return the stack size class of a silk.
+ */
+static inline struct silk_stack_class_t *
+silk_get_stack_class_from_id(struct silk_engine_t   *engine,
+                             silk_id_t              silk_id)
+{
+    return &engine->stack_class[silk_get_ctrl_from_id(engine, silk_id)->stack_class];
+}
+
+/*
+ * the header page at the start of a segment of the stacks added when the pool grows (see
+ * "stack_seg"). it is read-only once the segment is reserved.
+ */
+struct silk_stack_seg_t {
+    // the silk using the first stack of the segment
+    silk_id_t                              first_silk_id;
+};
+// the first stack of a segment is after the header page & its separator pages
+#define SILK_STACK_SEG_OFFSET(engine)                                   \
+    (PAGE_SIZE + (engine)->cfg.num_stack_seperator_pages * PAGE_SIZE)
+
+/*
+ * return the lower address of the stack of a silk added when the pool grew, in its segment.
+ * the segment must be reserved.
+ */
+static inline void *
+silk__stack_seg_addr(struct silk_engine_t   *engine,
+                     silk_id_t              silk_id)
+{
+    const uint32_t   idx = silk_id - engine->num_boot_silk;
+
+    assert(engine->stack_seg[idx / SILK_STACK_SEG_SILKS] != NULL);
+    return engine->stack_seg[idx / SILK_STACK_SEG_SILKS] + SILK_STACK_SEG_OFFSET(engine) +
+        (idx % SILK_STACK_SEG_SILKS) * engine->stack_class[0].padded_stack_size;
+}
+
 /*
  * return the lower address of the buffer used as the stack for a silk.
  */
@@ -176,8 +630,25 @@ static inline void *
 silk_get_stack_from_id(struct silk_engine_t   *engine,
                        silk_id_t              silk_id)
 {
-    SILK_ASSERT_ID(engine, silk_id);
-    return engine->stack_addr + silk_id * SILK_PADDED_STACK(&engine->cfg);
+    const struct silk_stack_class_t   *cls = silk_get_stack_class_from_id(engine, silk_id);
+
+    if (unlikely(engine->num_run_stacks > 0)) {
+        return engine->run_stack[silk_id % engine->num_run_stacks].stack_addr;
+    }
+    if (unlikely(silk_id >= engine->num_boot_silk)) {
+        return silk__stack_seg_addr(engine, silk_id);
+    }
+    return cls->stack_addr + (silk_id - cls->first_silk_id) * cls->padded_stack_size;
+}
+
+/*
+ * return the size (in bytes) of the useable stack of a silk.
+ */
+static inline size_t
+silk_get_stack_size_from_id(struct silk_engine_t   *engine,
+                            silk_id_t              silk_id)
+{
+    return silk_get_stack_class_from_id(engine, silk_id)->stack_size;
 }
 
 /*
@@ -188,19 +659,21 @@ static inline void *
 silk_get_initial_stack_from_id(struct silk_engine_t   *engine,
                                silk_id_t              silk_id)
 {
-#if defined (__i386__)
-    return (silk_get_stack_from_id(engine, silk_id) + SILK_USEABLE_STACK(&engine->cfg) - 1);
-#elif defined (__x86_64__)
-    assert(0); // TODO: implement this
+#if defined (__i386__) || defined (__x86_64__)
+    // x86 stack grows downward
+    return (silk_get_stack_from_id(engine, silk_id) + silk_get_stack_size_from_id(engine, silk_id) - 1);
 #endif
 }
 
-static inline struct silk_t *
-silk_get_ctrl_from_id(struct silk_engine_t   *engine,
-                      silk_id_t              silk_id)
+/*
+ * return the lower address of the scratch memory arena of a silk.
+ */
+static inline void *
+silk_get_arena_from_id(struct silk_engine_t   *engine,
+                       silk_id_t              silk_id)
 {
     SILK_ASSERT_ID(engine, silk_id);
-    return engine->silks + silk_id;
+    return engine->arena_addr + silk_id * engine->arena_size;
 }
 
 
@@ -211,37 +684,59 @@ silk_get_ctrl_from_id(struct silk_engine_t   *engine,
  ******************************************************************************/
 
 /*
- * returns the silk id of the caller
- * we use the stack address to find the silk instance
+ * returns the silk id whose stack holds an address (e.g.: of a stack variable). the silks
+ * must not share run stacks (SILK_CFG_FLAG_SHARED_STACK).
  */
 static inline silk_id_t
-silk__my_id()
+silk_get_id_from_stack(struct silk_engine_t   *engine,
+                       const void             *addr)
 {
-    struct silk_execution_thread_t *exec_thr = silk__my_thread_obj();
-    struct silk_engine_t           *engine = exec_thr->engine;
+    const struct silk_stack_class_t  *cls = engine->stack_class;
     uintptr_t   stk_start = (uintptr_t)engine->stack_addr;
-    size_t      stack_size = SILK_PADDED_STACK(&engine->cfg) * engine->cfg.num_silk;
-    uintptr_t   stk_end = (uintptr_t)(engine->stack_addr) + stack_size;
-    // take the address of any stack variable
-    uintptr_t   stk_addr = (uintptr_t)&engine;
+    uintptr_t   stk_end = (uintptr_t)(engine->stack_addr) + engine->stack_area_size;
+    uintptr_t   stk_addr = (uintptr_t)addr;
+    uintptr_t   seg_addr;
     silk_id_t   silk_id;
 
 
-    assert((stk_addr >= stk_start) && (stk_addr < stk_end));
-    silk_id = (stk_addr - stk_start) / SILK_PADDED_STACK(&engine->cfg);
+    assert(engine->num_run_stacks == 0);
+    if (unlikely((stk_addr < stk_start) || (stk_addr >= stk_end))) {
+        // a silk added when the pool grew. its segment header has the first silk in it
+        seg_addr = stk_addr & ~(engine->stack_seg_size - 1);
+        assert(engine->stack_seg_size > 0);
+        return ((const struct silk_stack_seg_t *)seg_addr)->first_silk_id +
+            (stk_addr - seg_addr - SILK_STACK_SEG_OFFSET(engine)) / cls->padded_stack_size;
+    }
+    // the classes are consecutive in the stack area
+    while (stk_addr >= (uintptr_t)cls->stack_addr +
+           cls->padded_stack_size * __atomic_load_n(&cls->num_silk, __ATOMIC_ACQUIRE)) {
+        cls++;
+        assert(cls < engine->stack_class + engine->num_stack_classes);
+    }
+    silk_id = cls->first_silk_id + (stk_addr - (uintptr_t)cls->stack_addr) / cls->padded_stack_size;
     return silk_id;
 }
 
 /*
  * returns the control-object for the silk making the call.
+ * the engine keeps the running silk in TLS, so this is a single load.
 */
 static inline struct silk_t *
 silk__my_ctrl()
 {
-    struct silk_execution_thread_t *exec_thr = silk__my_thread_obj();
-    struct silk_engine_t           *engine = exec_thr->engine;
-    const silk_id_t                 my_silk_id = silk__my_id();
-    return &engine->silks[my_silk_id];
+    struct silk_t   *s = silk__my_cur_silk();
+
+    assert(s != NULL);
+    return s;
+}
+
+/*
+ * returns the silk id of the caller
+ */
+static inline silk_id_t
+silk__my_id()
+{
+    return silk__my_ctrl()->silk_id;
 }
 
 static inline struct silk_t *
@@ -249,7 +744,77 @@ silk_id_to_ctrl(silk_id_t    silk_id)
 {
     struct silk_execution_thread_t *exec_thr = silk__my_thread_obj();
     struct silk_engine_t           *engine = exec_thr->engine;
-    return &engine->silks[silk_id];
+    return silk_get_ctrl_from_id(engine, silk_id);
+}
+
+/*
+ * allocate scratch memory from the arena of the calling silk. there is no free (& no
+ * lock): the arena is reset when the silk returns to the free list or is recycled
+ * after being killed, so the memory is valid until the entry function returns.
+ * returns NULL when the arena is exhausted (or the engine has no arenas).
+ */
+static inline void *
+silk_arena_alloc(size_t    size)
+{
+    struct silk_execution_thread_t *exec_thr = silk__my_thread_obj();
+    struct silk_engine_t           *engine = exec_thr->engine;
+    struct silk_t                  *s = silk__my_ctrl();
+    size_t   offset = (s->arena_used + SILK_ARENA_ALIGN - 1) & ~((size_t)SILK_ARENA_ALIGN - 1);
+
+    if (unlikely((offset > engine->arena_size) || (size > engine->arena_size - offset))) {
+        return NULL;
+    }
+    s->arena_used = offset + size;
+    return silk_get_arena_from_id(engine, s->silk_id) + offset;
+}
+
+/*
+ * release everything the calling silk allocated from its arena. this lets a silk which
+ * serves many requests reuse its arena for each of them.
+ */
+static inline void
+silk_arena_reset(void)
+{
+    silk__my_ctrl()->arena_used = 0;
+}
+
+/*
+ * a key of a silk-local storage slot: the offset of the slot from the end of the control block
+ */
+typedef uint32_t   silk_local_key_t;
+
+/*
+ * register a silk-local storage slot of "size" bytes in the configuration of an engine,
+ * before silk_init(). every silk then has such a slot, right after its control block. it
+ * is zeroed when the silk returns to the free list or is recycled after being killed.
+ */
+static inline silk_local_key_t
+silk_local_key_register(struct silk_engine_param_t   *param,
+                        size_t                       size)
+{
+    silk_local_key_t   key = (param->local_size + SILK_LOCAL_ALIGN - 1) & ~(SILK_LOCAL_ALIGN - 1);
+
+    param->local_size = key + size;
+    return key;
+}
+
+/*
+ * return the silk-local storage slot of a silk (e.g.: to set it up before dispatching it)
+ */
+static inline void *
+silk_get_local(struct silk_t      *s,
+               silk_local_key_t   key)
+{
+    return (char *)(s + 1) + key;
+}
+
+/*
+ * return the silk-local storage slot of the calling silk
+ */
+static inline void *
+silk_local(silk_local_key_t   key)
+{
+    return silk_get_local(silk__my_ctrl(), key);
 }
 
 void silk_yield(struct silk_msg_t   *msg);
@@ -268,6 +833,7 @@ enum silk_status_e
 silk_alloc(struct silk_engine_t   *engine,
            silk_uthread_func_t    entry_func,
            void                   *entry_func_arg,
+           uint32_t               flags,
            struct silk_t        **silk);
 
 enum silk_status_e
@@ -275,6 +841,19 @@ silk_dispatch(struct silk_engine_t   *engine,
               struct silk_t          *s);
 
 
+/*
+ * copy the stack usage profile of the entry functions which exited so far
+ * (SILK_CFG_FLAG_STACK_PROFILE).
+ * Input
+ * profiles - the buffer to copy into.
+ * num_profiles - the number of entries in the buffer. returns the number copied.
+ */
+enum silk_status_e
+silk_stack_profile_get(struct silk_engine_t          *engine,
+                       struct silk_stack_profile_t   *profiles,
+                       uint32_t                      *num_profiles);
+
+
 /*
  * allows any thread (rather than only a silk instance) to kill a silk instance.
  */
@@ -305,7 +884,10 @@ silk_kill_id(silk_id_t      silk_id)
 
 
 /*
- * send a msg object into the engine msg queue
+ * send a msg object into the engine msg queue. a msg to a silk beyond the pool (e.g.: one
+ * released when the pool shrank) is rejected. a msg which races with the shrink is dropped
+ * by the engine instead.
+ * BEWARE: once the pool grows again, the ID belongs to a new silk which would get the msg.
  */
 static inline enum silk_status_e
 silk_send_msg (struct silk_engine_t                  *engine,
@@ -314,6 +896,9 @@ silk_send_msg (struct silk_engine_t                  *engine,
     enum silk_status_e    silk_stat;
 
     SILK_DEBUG("send msg={code=%d, id=%d, ctx=%p}", msg->msg, msg->silk_id, msg->ctx);
+    if (unlikely(msg->silk_id >= silk_get_num_silk(engine))) {
+        return SILK_STAT_INVALID_SILK_ID;
+    }
     silk_stat = silk_sched_send(&engine->msg_sched, msg);
     return silk_stat;
 }
@@ -333,6 +918,83 @@ silk_send_msg_code (struct silk_engine_t                  *engine,
     return silk_send_msg (engine, &msg);
 }
 
+/*
+ * allocate a msg payload of "payload_size" bytes from the pool of the engine. returns
+ * NULL when the pool is exhausted. the payloads are cached per thread, so some of the
+ * free payloads may be kept by the caches of other threads.
+ */
+void *
+silk_payload_alloc(struct silk_engine_t   *engine);
+
+/*
+ * return a payload to the pool. only needed for payloads which were not sent.
+ */
+void
+silk_payload_free(struct silk_engine_t   *engine,
+                  void                   *payload);
+
+/*
+ * send a msg with a payload from silk_payload_alloc(). once sent, the payload belongs to
+ * the receiver until it calls silk_yield() again (or returns), when it is freed.
+ */
+static inline enum silk_status_e
+silk_send_msg_payload(struct silk_engine_t                 *engine,
+                      enum silk_msg_code_e                 msg_code,
+                      uint32_t                             silk_id,
+                      void                                 *payload)
+{
+    struct silk_msg_t        msg = {
+        .msg = msg_code,
+        .silk_id = silk_id,
+        .ctx = payload,
+        .flags = SILK_MSG_FLAG__PAYLOAD,
+    };
+    return silk_send_msg (engine, &msg);
+}
+
+#if SILK_MSG_INLINE_SIZE > 0
+/*
+ * send a msg with a small payload (up to SILK_MSG_INLINE_SIZE bytes) which is copied into
+ * the msg itself, so there is nothing to allocate or free.
+ */
+static inline enum silk_status_e
+silk_send_msg_inline(struct silk_engine_t                 *engine,
+                     enum silk_msg_code_e                 msg_code,
+                     uint32_t                             silk_id,
+                     const void                           *data,
+                     size_t                               len)
+{
+    struct silk_msg_t        msg = {
+        .msg = msg_code,
+        .silk_id = silk_id,
+        .flags = SILK_MSG_FLAG__INLINE,
+        .inline_len = len,
+    };
+
+    if (unlikely(len > SILK_MSG_INLINE_SIZE)) {
+        return SILK_STAT_MSG_TOO_LARGE;
+    }
+    memcpy(msg.inline_data, data, len);
+    return silk_send_msg (engine, &msg);
+}
+
+/*
+ * return the inline payload of a received msg & its length (NULL when it has none).
+ * the payload is part of the msg, so it lives as long as the msg the silk_yield() filled.
+ */
+static inline const void *
+silk_msg_inline_data(const struct silk_msg_t   *msg,
+                     size_t                    *len)
+{
+    *len = 0;
+    if (!(msg->flags & SILK_MSG_FLAG__INLINE)) {
+        return NULL;
+    }
+    *len = msg->inline_len;
+    return msg->inline_data;
+}
+#endif // SILK_MSG_INLINE_SIZE > 0
+
 /*
  * query the number of free silks (i.e.: ready to be allocated)
  */
@@ -22,10 +22,13 @@
 #include <stdio.h>
 
 /*
- * Use syslog macros to decide on the debugging level for SILK
+ * Use syslog macros to decide on the debugging level for SILK. benchmarks built by the
+ * Makefile override it with -DSILK_LOG_LEVEL=LOG_ERR
  */
+#ifndef SILK_LOG_LEVEL
 #define SILK_LOG_LEVEL    LOG_DEBUG // for development
 //#define SILK_LOG_LEVEL    LOG_ERR // for performance measurements
+#endif
 
 #define SILK_ERROR(fmt, ...)   do { if (SILK_LOG_LEVEL >= LOG_ERR) {printf("ERR :" fmt "\n", ## __VA_ARGS__); }} while (0);
 #define SILK_WARN(fmt, ...)    do { if (SILK_LOG_LEVEL >= LOG_WARNING) {printf("WARN:" fmt "\n", ## __VA_ARGS__); }} while (0);
@@ -51,6 +54,81 @@
  */
 #define SILK_MIN_NUM_THREADS                        2
 
+/*
+ * The number of silks the pool grows by when silk_alloc() finds no free silk (unless
+ * configured otherwise, see "max_silk")
+ */
+#define SILK_DFLT_GROW_SILKS                        16
+
+/*
+ * The minimal number of msgs the msg queue of an engine holds (unless configured otherwise,
+ * see "msg_queue_size"). it is larger when the silks booted by silk_init() need more.
+ */
+#define SILK_DFLT_MSG_QUEUE_SIZE                    (8 * 1024)
+
+/*
+ * The number of stacks in a segment of the stack area added when the pool grows (a power of 2)
+ */
+#define SILK_STACK_SEG_SILKS                        1024
+
+/*
+ * The maximal number of stack size classes an engine can have
+ */
+#define SILK_MAX_STACK_CLASSES                      4
+
+/*
+ * The maximal number of entry functions whose stack usage is profiled
+ */
+#define SILK_STACK_PROFILE_MAX_FUNCS                32
+
+/*
+ * The maximal number of silks the idle processing checks for hibernation on each pass
+ */
+#define SILK_HIBERNATE_SCAN_BATCH                   64
+
+/*
+ * The size of the alternate signal stack on which stack overflows are handled
+ */
+#define SILK_GUARD_ALT_STACK_SIZE                   (64 * 1024)
+
+/*
+ * The size of a huge page (SILK_CFG_FLAG_HUGE_PAGES). the default size on x86
+ */
+#define SILK_HUGE_PAGE_SIZE                         (2 * 1024 * 1024)
+
+/*
+ * The maximal number of NUMA nodes an engine can be bound to (SILK_CFG_FLAG_NUMA_BIND)
+ */
+#define SILK_NUMA_MAX_NODES                         1024
+
+/*
+ * The alignment of the memory allocated from the arena of a silk
+ */
+#define SILK_ARENA_ALIGN                            16
+
+/*
+ * The alignment of the silk-local storage slots (see silk_local_key_register())
+ */
+#define SILK_LOCAL_ALIGN                            8
+
+/*
+ * The size of a CPU cache line. data written by different threads (e.g.: the producer &
+ * consumer sides of the msg queue) is kept on separate cache lines, so they dont bounce
+ * a line between their CPUs (false sharing).
+ */
+#define SILK_CACHE_LINE_SIZE                        64
+#define SILK_CACHE_ALIGNED                          __attribute__((aligned(SILK_CACHE_LINE_SIZE)))
+
+/*
+ * The msg payload pool: the alignment of each payload (SILK_CACHE_LINE_SIZE), the size of the
+ * per-thread caches, the number of payloads moved between a cache & the pool at once &
+ * the number of caches shared by the threads which send msgs to an engine
+ */
+#define SILK_PAYLOAD_ALIGN                          SILK_CACHE_LINE_SIZE
+#define SILK_PAYLOAD_CACHE_SIZE                     32
+#define SILK_PAYLOAD_CACHE_BATCH                    16
+#define SILK_PAYLOAD_NUM_CACHES                     8
+
 /*
  * This is the Silk ID of the instance which is used to start running when the engine comes up
  */
@@ -71,6 +149,20 @@ enum silk_status_e {
     SILK_STAT_STACK_PROTECTION_SCHEME_FAILED,
     SILK_STAT_Q_FULL,
     SILK_STAT_NO_FREE_SILK,
+    SILK_STAT_INVALID_STACK_COMMIT_POLICY,
+    SILK_STAT_INVALID_STACK_RELEASE_POLICY,
+    SILK_STAT_INVALID_STACK_CLASS,
+    SILK_STAT_INVALID_SHARED_STACK,
+    SILK_STAT_INVALID_HIBERNATE_POLICY,
+    SILK_STAT_INVALID_STACK_GUARD,
+    SILK_STAT_INVALID_NUMA_NODE,
+    SILK_STAT_NUMA_BIND_FAILED,
+    SILK_STAT_INVALID_PAYLOAD_POOL,
+    SILK_STAT_MSG_TOO_LARGE,
+    SILK_STAT_INVALID_POOL_GROWTH,
+    SILK_STAT_INVALID_MSG_QUEUE_SIZE,
+    SILK_STAT_ENGINE_MISALIGNED,
+    SILK_STAT_INVALID_SILK_ID,
 };
 
 /*
@@ -82,6 +174,7 @@ enum __attribute__((packed)) silk_msg_code_e {
     SILK_MSG_START,          // instruct the uthread to start running.
     SILK_MSG_TERM,           // instructs the uthread to terminate
     SILK_MSG_TERM_THREAD,    // instructs the kernel thread to terminate (in preparation for processing halt)
+    SILK_MSG_NOOP,           // ignored by a free silk. moves the engine thread onto its stack
     SILK_MSG_CODE_LAST,      // the last valid of msg codes used by the Silk library.
 
     // msg code range available for the application that uses the Silk library
@@ -91,7 +184,14 @@ enum __attribute__((packed)) silk_msg_code_e {
 /*
  * a unique integer identifying the silk instance.
  */
-typedef uint16_t   silk_id_t;
+typedef uint32_t   silk_id_t;
+// the maximal number of silks of an engine
+#define SILK_MAX_NUM_SILK   UINT32_MAX
+
+// the length of the inline payload is kept in a byte
+#if SILK_MSG_INLINE_SIZE > 255
+#error "SILK_MSG_INLINE_SIZE must not exceed 255 bytes"
+#endif
 
 /*
  * encapsulate a message that is sent to a silk micro-thread
@@ -104,8 +204,25 @@ struct silk_msg_t {
   silk_id_t                   silk_id;
     // TODO: we need a generation in which the msg was sent so that a silk wont process a msg from its previous lifetime. (so genenation counter per silk_t)
   enum silk_msg_code_e        msg;
+  // SILK_MSG_FLAG__*
+  uint8_t                     flags;
+#if SILK_MSG_INLINE_SIZE > 0
+  // the number of bytes in "inline_data" (SILK_MSG_FLAG__INLINE)
+  uint8_t                     inline_len;
+  // a small payload carried by value (see silk_send_msg_inline())
+  uint8_t                     inline_data[SILK_MSG_INLINE_SIZE] __attribute__((aligned(8)));
+#endif
 };
 
+/*
+ * the msg flags
+ * PAYLOAD: "ctx" is a payload from silk_payload_alloc() which is freed once the receiver
+ *          calls silk_yield() again (or its entry function returns)
+ * INLINE:  the msg carries "inline_len" bytes of payload in "inline_data"
+ */
+#define SILK_MSG_FLAG__PAYLOAD      0x01
+#define SILK_MSG_FLAG__INLINE       0x02
+
  
 
 #endif // __SILK_BASE_H__
@@ -3,15 +3,93 @@
  */
 #include "config.h"
 #include <assert.h>
+#include <cpuid.h>
 #include "silk_context.h"
 
 
 
 #if defined (SILK_CONTEXT__LIBC)
+
+
+void silk_create_initial_stack_context(struct silk_exec_state_t *initial_ctx,
+                                       void    (*start_func) (void),
+                                       char     *stack_buf,
+                                       size_t    size)
+{
+    int   rc;
+
+    rc = getcontext(&initial_ctx->libc_state);
+    assert(rc == 0);
+    initial_ctx->libc_state.uc_stack.ss_sp = stack_buf;
+    initial_ctx->libc_state.uc_stack.ss_size = size;
+    // the start function never returns, so there's no context to link to.
+    initial_ctx->libc_state.uc_link = NULL;
+    makecontext(&initial_ctx->libc_state, start_func, 0);
+#if defined (SILK_CONTEXT__LIBC_NO_SIGMASK)
+    initial_ctx->is_started = false;
+#endif
+}
+
+#if defined (SILK_CONTEXT__LIBC_NO_SIGMASK)
+
 /*
-void makecontext(ucontext_t *ucp, void (*func)(), int argc, ...);
-int swapcontext(ucontext_t *oucp, ucontext_t *ucp);
-*/
+ * gcc requires __builtin_longjmp() to be called from a different function than the
+ * one which called __builtin_setjmp() for the same buffer.
+ */
+static void __attribute__((noinline, noreturn))
+silk_jump_context(void   **jmp_buf)
+{
+    __builtin_longjmp(jmp_buf, 1);
+}
+
+/*
+ * switch from one silk to another without any syscall. 
+ * The signal mask is the one of the pthread running the engine & it is never changed
+ * by a switch. setcontext() still restores the signal mask, but only once per silk
+ * (re)start, when it runs on a fresh stack.
+ * Notes:
+ * 1) the "to" state must be read before "from" is saved bcz the recycle path swaps
+ *    a freshly initialized silk into itself (i.e.: to == from).
+ * 2) __builtin_setjmp() makes gcc save all callee-saved registers in this function
+ *    frame, so they are restored when we return here through silk_jump_context().
+ */
+void silk_swap_context(struct silk_exec_state_t *switch_to,
+                       struct silk_exec_state_t *switch_from)
+{
+    const bool   is_resume = switch_to->is_started;
+
+    if (__builtin_setjmp(switch_from->jmp_buf) == 0) {
+        switch_from->is_started = true;
+        if (is_resume) {
+            silk_jump_context(switch_to->jmp_buf);
+        }
+        switch_to->is_started = true;
+        setcontext(&switch_to->libc_state);
+        assert(0); // setcontext() returns only on failure
+    }
+}
+
+#else // SILK_CONTEXT__LIBC_NO_SIGMASK
+
+/*
+ * switch from one silk to another. swapcontext() saves & restores the signal mask
+ * as well, so each switch costs a rt_sigprocmask syscall.
+ */
+void silk_swap_context(struct silk_exec_state_t *switch_to,
+                       struct silk_exec_state_t *switch_from)
+{
+    int    rc;
+
+    if (switch_to == switch_from) {
+        // a silk recycling itself - it just restarts from its fresh context.
+        setcontext(&switch_to->libc_state);
+        assert(0); // setcontext() returns only on failure
+    }
+    rc = swapcontext(&switch_from->libc_state, &switch_to->libc_state);
+    assert(rc == 0);
+}
+
+#endif // SILK_CONTEXT__LIBC_NO_SIGMASK
 
 #elif defined (SILK_CONTEXT__MINIMAL)
 
@@ -36,6 +114,9 @@ int swapcontext(ucontext_t *oucp, ucontext_t *ucp);
  *         The original set of eight 128-bit SSE registers is increased to sixteen.
  *         AVX register (256-bit wide)
  * different applications might require different registers to be saved in the context.
+ * The switch itself never saves the x87/MMX/SSE/AVX state nor the x87 control word & MXCSR.
+ * silks that need them preserved ask for it on allocation (SILK_ALLOC_FLAG__FPU_*) & the
+ * engine saves/restores them around the switch using the silk_fpu_*() functions below.
  * Always make sure we have enough space for the Red Zone (128 byte with GCC)
  *
  *
@@ -74,40 +155,37 @@ int swapcontext(ucontext_t *oucp, ucontext_t *ucp);
  */
 #if defined (__i386__)
 
-#if 0
 /*
- * do a context switch between the uthread pointed
- * register EAX & ECX are defined such that the caller responsibility is to save & restore them – hence we don’t need to save/restore them as part of the context.
- * we also ignore floating-point registers as we assume they are not used
- * TODO:
- * 1) what about SSE & friends regarding any compiler specific optimizations ?
- * 2) we need x86 & x86-64 versions
- * 3) consider the use of "volatile" to prevent optimizer from playing around here. would it make the use of "inline" safe ?
- *
- * BEWARE: inline assembly sometimes causes the compiler to generate wrong code. however, its better for performance bcz each function that calls for a context switch will have its own copy thereby allowing branch prediction to accurately predict the jumps. and it also save stack frame work :)
- *
- * Input:
- * first parameter is the destination stack, here its EAX register
- * first parameter is the source??? stack, here its EDX register
+ * Note:
+ * the SILK_CONTEXT__MINIMAL_INLINE variant of SILK_SWITCH (see silk_context.h) is an
+ * inline version of the below. it saves only EBP & the resume address on the stack,
+ * so the initial stack frame is built accordingly.
  */
-/*static*/ void
-silk_swap_stack_context(void***, void**) __attribute__((regparm(2)))
-{
-    __asm__ __volatile__ (
-	    "pushl %ebp\n\t"
-	    "pushl %ebx\n\t"
-	    "pushl %esi\n\t"
-	    "pushl %edi\n\t"
-	    "movl  %esp, (%eax)\n\t"
-	    "movl  %edx, %esp\n\t"
-	    "popl  %edi\n\t"
-	    "popl  %esi\n\t"
-	    "popl  %ebx\n\t"
-	    "popl  %ebp\n\t"
-	    "ret\n\t"
-	    );
-}
-#endif // #if 0
+
+
+/*
+ * The first frame of every silk. the switch "returns" here with the stack pointer
+ * at the address of the start function, which is called as if from a regular function.
+ * the return address it pushes lies inside this trampoline whose CFI marks the return
+ * address as undefined, so unwinders (gdb, perf, _Unwind_Backtrace) know the start
+ * function is the outermost frame instead of reading garbage above it.
+ * The start function is never expected to return.
+ */
+__asm__ (
+         ".pushsection .text\n"
+         ".type silk_start_trampoline, @function\n"
+         ".global silk_start_trampoline\n"
+         ".hidden silk_start_trampoline\n"
+         "silk_start_trampoline:\n"
+         ".cfi_startproc\n"
+         ".cfi_undefined %eip\n"
+         "call *(%esp)\n"
+         "ud2\n"
+         ".cfi_endproc\n"
+         ".size silk_start_trampoline, .-silk_start_trampoline\n"
+         ".popsection\n"
+         "");
+void silk_start_trampoline(void);
 
 
 void silk_create_initial_stack_context(struct silk_exec_state_t *initial_ctx,
@@ -122,11 +200,19 @@ void silk_create_initial_stack_context(struct silk_exec_state_t *initial_ctx,
     // verify 16-byte alignment as gcc ABI requires.
     assert((btm & ~0xf) == btm);
 
-    // Stack frame alignment. TODO: is this a must ???
+    /*
+     * the trampoline calls the start function with ESP pointing at its address, so
+     * that address must be 16-byte aligned for the start function to be entered with
+     * (ESP + 4) aligned just like after a regular "call".
+     */
+    p--; *p = 0;
+    p--; *p = 0;
     p--; *p = 0;
+    p--; *p = start_func;
 
-    p--; *p = start_func; // EIP
-    p--; *p = bottom;     // EBP
+    p--; *p = silk_start_trampoline; // EIP
+    p--; *p = 0;          // EBP - terminates frame-pointer based stack walks
+#if !defined (SILK_CONTEXT__MINIMAL_INLINE)
     p--; *p = 0;          // EBX
     p--; *p = 0;          // ESI
     p--; *p = 0;          // EDI
@@ -135,29 +221,47 @@ void silk_create_initial_stack_context(struct silk_exec_state_t *initial_ctx,
     // TODO: is this a must ???
     p--; *p = 0;
     p--; *p = 0;
+#endif
 
     // return to the entry point of the new silk thread.
     initial_ctx->esp = p;
 }
 
+#if !defined (SILK_CONTEXT__MINIMAL_INLINE)
+/*
+ * the CFI directives describe where each saved register lives while the frame is
+ * being built & torn down. the silk we switch into has the same frame layout on its
+ * own stack, so the same CFI remains correct after ESP is switched.
+ */
 __asm__ /*__volatile__*/ (
                       ".pushsection .text\n"
                       ".type silk_swap_stack_context, @function\n"
                       ".global silk_swap_stack_context\n"
                       "silk_swap_stack_context:\n"
+                      ".cfi_startproc\n"
 
                       // save frame pointer
                       "push %ebp\n"
+                      ".cfi_adjust_cfa_offset 4\n"
+                      ".cfi_rel_offset %ebp, 0\n"
                       "movl %esp, %ebp\n"
 
                       // save callee owned registers
                       "push %ebx\n"
+                      ".cfi_adjust_cfa_offset 4\n"
+                      ".cfi_rel_offset %ebx, 0\n"
                       "push %esi\n"
+                      ".cfi_adjust_cfa_offset 4\n"
+                      ".cfi_rel_offset %esi, 0\n"
                       "push %edi\n"
+                      ".cfi_adjust_cfa_offset 4\n"
+                      ".cfi_rel_offset %edi, 0\n"
 
                       // push 2 more DWORDs for 16-byte alignment
                       "pushl $0\n"
+                      ".cfi_adjust_cfa_offset 4\n"
                       "pushl $0\n"
+                      ".cfi_adjust_cfa_offset 4\n"
 
                       // switch stack, saving the the stack pointer in EAX (second argument)
                       "movl 0xc(%ebp), %edx\n"  // load address of old ESP variable into register
@@ -166,27 +270,59 @@ __asm__ /*__volatile__*/ (
 
                       // pop 2(?3?) extra DWORDs
                       "pop %edi\n"
+                      ".cfi_adjust_cfa_offset -4\n"
                       "pop %edi\n"
+                      ".cfi_adjust_cfa_offset -4\n"
                       //"pop %edi\n"
 
                       // restore callee owned registers
                       "pop %edi\n"
+                      ".cfi_adjust_cfa_offset -4\n"
+                      ".cfi_restore %edi\n"
                       "pop %esi\n"
+                      ".cfi_adjust_cfa_offset -4\n"
+                      ".cfi_restore %esi\n"
                       "pop %ebx\n"
+                      ".cfi_adjust_cfa_offset -4\n"
+                      ".cfi_restore %ebx\n"
 
                       // restore frame pointer
                       "pop  %ebp\n"
+                      ".cfi_adjust_cfa_offset -4\n"
+                      ".cfi_restore %ebp\n"
 
                       "ret\n"
+                      ".cfi_endproc\n"
+                      ".size silk_swap_stack_context, .-silk_swap_stack_context\n"
 
                       ".popsection\n"
                       "");
+#endif // !SILK_CONTEXT__MINIMAL_INLINE
 
 #elif defined (__x86_64__)
 
+/*
+ * The first frame of every silk (see the IA32 version for details).
+ */
+__asm__ (
+         ".pushsection .text\n"
+         ".type silk_start_trampoline, @function\n"
+         ".global silk_start_trampoline\n"
+         ".hidden silk_start_trampoline\n"
+         "silk_start_trampoline:\n"
+         ".cfi_startproc\n"
+         ".cfi_undefined %rip\n"
+         "call *(%rsp)\n"
+         "ud2\n"
+         ".cfi_endproc\n"
+         ".size silk_start_trampoline, .-silk_start_trampoline\n"
+         ".popsection\n"
+         "");
+void silk_start_trampoline(void);
+
 
 void silk_create_initial_stack_context(struct silk_exec_state_t *initial_ctx,
-                                       silk_uthread_func_t start_func,
+                                       void    (*start_func) (void),
                                        char     *stack_buf,
                                        size_t    size)
 {
@@ -194,60 +330,209 @@ void silk_create_initial_stack_context(struct silk_exec_state_t *initial_ctx,
     void  **p = (void**)bottom;
     const intptr_t   btm = (uintptr_t)bottom;
 
-    // clear all registers for a clean start.
-    memset(initial_ctx, 0, sizeof(*initial_ctx));
-    // the return address in stack so we jump to it when we return 
-    p--; *p = initial_func;
+    // verify 16-byte alignment as the ABI requires.
+    assert((btm & ~0xf) == btm);
+
+    /*
+     * the trampoline calls the start function with RSP pointing at its address, so
+     * that address must be 16-byte aligned: the ABI requires (RSP + 8) to be 16-byte
+     * aligned on function entry (i.e.: just after the "call" pushed the return address).
+     */
+    p--; *p = 0;
+    p--; *p = start_func;
+
+    p--; *p = silk_start_trampoline; // RIP
+    p--; *p = 0;          // RBP - terminates frame-pointer based stack walks
+#if !defined (SILK_CONTEXT__MINIMAL_INLINE)
+    p--; *p = 0;          // RBX
+    p--; *p = 0;          // R12
+    p--; *p = 0;          // R13
+    p--; *p = 0;          // R14
+    p--; *p = 0;          // R15
+#endif
+
+    // return to the entry point of the new silk thread.
     initial_ctx->rsp = p;
 }
 
+#if !defined (SILK_CONTEXT__MINIMAL_INLINE)
 /*
  * The general structure here (x86-64) is:
  *     1) function takes 2 arguments, which are passed in RDI (first) & RSI (second). The C prototype
- *        is “void silk_switch_ctx (strcut silk_context_t  *switch_from, strcut silk_context_t  *switch_to);”
- *     2) save registers of context A into a buffer pointed by register RDI
- *     3) switch stack pointer
- *     4) restore registers of context B from a buffer pointed by register RSI*
- * The registers we save are the stack pointer & all those that “belong” to caller !!! the rest of
- * the registers “belong” the the callee & hence the code which calls this function already saved them.
+ *        is "void silk_swap_stack_context(void *switch_to_rsp, void **switch_from_rsp);"
+ *     2) push the callee-saved registers of the current context on its own stack
+ *     3) save the stack pointer into the address in RSI & switch to the stack pointer in RDI
+ *     4) pop the callee-saved registers of the new context from its stack & return into it
+ * The registers we save are the stack pointer & all those that "belong" to caller !!! the rest of
+ * the registers "belong" the the callee & hence the code which calls this function already saved them.
+ * Unlike IA32, no padding is required: the return address & 6 registers keep the stack
+ * 16-byte aligned in the same way the "call" instruction left it.
+ * The CFI directives keep the CFA at RSP + the size of the frame so far. Both stacks have
+ * the same frame layout so it stays correct across the stack switch, & a profiler sample
+ * taken at any instruction here unwinds into the silk that owns the stack at that point.
  *
  * BEWARE: 
- * we ignore floating-point, MMX & AVX registers here !!!
+ * we ignore floating-point, MMX & AVX registers here !!! (silks which need them preserved
+ * are allocated with SILK_ALLOC_FLAG__FPU_*)
  */
-void silk_swap_stack_context(struct silk_exec_state_t *switch_from, 
-                             struct silk_exec_state_t *switch_to)
-{
-    asm(""
-        ".pushsection .text\n"
-        ".type silk_swap_stack_context, @function\n"
-        ".global silk_swap_stack_context\n"
-        "silk_swap_stack_context:\n"
-
-        "moveq %rbx, 0(%rdi)\n"
-        "moveq %rsp, 8(%rdi)\n"
-        "moveq %rbp, 16(%rdi)\n"
-        "moveq %r12, 24(%rdi)\n"
-        "moveq %r13, 32(%rdi)\n"
-        "moveq %r14, 40(%rdi)\n"
-        "moveq %r15, 48(%rdi)\n"
-
-        "xchg %rdi, %rsi\n"
-
-        "movq 0(%rdi), %rbx\n"
-        "movq 8(%rdi), %rsp\n"
-        "movq 16(%rdi), %rbp\n"
-        "movq 24(%rdi), %r12\n"
-        "movq 32(%rdi), %r13\n"
-        "movq 40(%rdi), %r14\n"
-        "movq 48(%rdi), %r15\n"
-
-        "retq\n"
-
-        ".popsection\n"
-        "");
-}
+__asm__ (
+         ".pushsection .text\n"
+         ".type silk_swap_stack_context, @function\n"
+         ".global silk_swap_stack_context\n"
+         "silk_swap_stack_context:\n"
+         ".cfi_startproc\n"
+
+         // save callee owned registers
+         "pushq %rbp\n"
+         ".cfi_adjust_cfa_offset 8\n"
+         ".cfi_rel_offset %rbp, 0\n"
+         "pushq %rbx\n"
+         ".cfi_adjust_cfa_offset 8\n"
+         ".cfi_rel_offset %rbx, 0\n"
+         "pushq %r12\n"
+         ".cfi_adjust_cfa_offset 8\n"
+         ".cfi_rel_offset %r12, 0\n"
+         "pushq %r13\n"
+         ".cfi_adjust_cfa_offset 8\n"
+         ".cfi_rel_offset %r13, 0\n"
+         "pushq %r14\n"
+         ".cfi_adjust_cfa_offset 8\n"
+         ".cfi_rel_offset %r14, 0\n"
+         "pushq %r15\n"
+         ".cfi_adjust_cfa_offset 8\n"
+         ".cfi_rel_offset %r15, 0\n"
+
+         // switch stack: save old RSP (second argument) & load the new one (first argument)
+         "movq %rsp, (%rsi)\n"
+         "movq %rdi, %rsp\n"
+
+         // restore callee owned registers
+         "popq %r15\n"
+         ".cfi_adjust_cfa_offset -8\n"
+         ".cfi_restore %r15\n"
+         "popq %r14\n"
+         ".cfi_adjust_cfa_offset -8\n"
+         ".cfi_restore %r14\n"
+         "popq %r13\n"
+         ".cfi_adjust_cfa_offset -8\n"
+         ".cfi_restore %r13\n"
+         "popq %r12\n"
+         ".cfi_adjust_cfa_offset -8\n"
+         ".cfi_restore %r12\n"
+         "popq %rbx\n"
+         ".cfi_adjust_cfa_offset -8\n"
+         ".cfi_restore %rbx\n"
+         "popq %rbp\n"
+         ".cfi_adjust_cfa_offset -8\n"
+         ".cfi_restore %rbp\n"
+
+         "ret\n"
+         ".cfi_endproc\n"
+
+         ".size silk_swap_stack_context, .-silk_swap_stack_context\n"
+         ".popsection\n"
+         "");
+#endif // !SILK_CONTEXT__MINIMAL_INLINE
 
 #endif // __x86_64__
 
 #endif // SILK_CONTEXT__MINIMAL
 
+
+#if defined (__i386__) || defined (__x86_64__)
+
+/*
+ * the way we save the full FPU state, detected once by silk_fpu_init()
+ */
+enum silk_fpu_save_method_e {
+    SILK_FPU_SAVE__UNKNOWN = 0,
+    SILK_FPU_SAVE__FXSAVE,      // x87/MMX/SSE only
+    SILK_FPU_SAVE__XSAVE,       // every state component enabled by the OS (e.g.: AVX)
+    SILK_FPU_SAVE__XSAVEOPT,    // same, skipping components not modified since restored
+};
+
+static enum silk_fpu_save_method_e   silk_fpu_method = SILK_FPU_SAVE__UNKNOWN;
+static size_t                        silk_fpu_area_size;
+// the xsave state-component bitmap (i.e.: XCR0)
+static uint64_t                      silk_fpu_xsave_mask;
+
+#if defined (__x86_64__)
+#define SILK_FPU_INSN(insn)     insn "64"
+#else
+#define SILK_FPU_INSN(insn)     insn
+#endif
+
+size_t silk_fpu_init(void)
+{
+    unsigned int   eax, ebx, ecx, edx;
+    uint32_t       lo, hi;
+
+    if (silk_fpu_method != SILK_FPU_SAVE__UNKNOWN) {
+        return silk_fpu_area_size;
+    }
+    silk_fpu_method = SILK_FPU_SAVE__FXSAVE;
+    silk_fpu_area_size = 512;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_OSXSAVE)) {
+        __asm__ __volatile__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+        silk_fpu_xsave_mask = ((uint64_t)hi << 32) | lo;
+        // EBX holds the area size for the components currently enabled in XCR0
+        __cpuid_count(0xd, 0, eax, ebx, ecx, edx);
+        silk_fpu_area_size = ebx;
+        silk_fpu_method = SILK_FPU_SAVE__XSAVE;
+        __cpuid_count(0xd, 1, eax, ebx, ecx, edx);
+        if (eax & 0x1) {
+            silk_fpu_method = SILK_FPU_SAVE__XSAVEOPT;
+        }
+    }
+    return silk_fpu_area_size;
+}
+
+void silk_fpu_save_full(void    *area)
+{
+    const uint32_t   lo = (uint32_t)silk_fpu_xsave_mask;
+    const uint32_t   hi = (uint32_t)(silk_fpu_xsave_mask >> 32);
+
+    switch (silk_fpu_method) {
+    case SILK_FPU_SAVE__XSAVEOPT:
+        __asm__ __volatile__ (SILK_FPU_INSN("xsaveopt") " (%0)"
+                              : : "r" (area), "a" (lo), "d" (hi) : "memory");
+        break;
+
+    case SILK_FPU_SAVE__XSAVE:
+        __asm__ __volatile__ (SILK_FPU_INSN("xsave") " (%0)"
+                              : : "r" (area), "a" (lo), "d" (hi) : "memory");
+        break;
+
+    case SILK_FPU_SAVE__FXSAVE:
+        __asm__ __volatile__ (SILK_FPU_INSN("fxsave") " (%0)"
+                              : : "r" (area) : "memory");
+        break;
+
+    default:
+        assert(0); // silk_fpu_init() wasnt called
+    }
+}
+
+void silk_fpu_restore_full(const void    *area)
+{
+    const uint32_t   lo = (uint32_t)silk_fpu_xsave_mask;
+    const uint32_t   hi = (uint32_t)(silk_fpu_xsave_mask >> 32);
+
+    switch (silk_fpu_method) {
+    case SILK_FPU_SAVE__XSAVEOPT:
+    case SILK_FPU_SAVE__XSAVE:
+        __asm__ __volatile__ (SILK_FPU_INSN("xrstor") " (%0)"
+                              : : "r" (area), "a" (lo), "d" (hi) : "memory");
+        break;
+
+    case SILK_FPU_SAVE__FXSAVE:
+        __asm__ __volatile__ (SILK_FPU_INSN("fxrstor") " (%0)"
+                              : : "r" (area) : "memory");
+        break;
+
+    default:
+        assert(0); // silk_fpu_init() wasnt called
+    }
+}
+
+#endif // __i386__ || __x86_64__
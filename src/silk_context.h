@@ -5,6 +5,7 @@
 #define __SILK_CONTEXT_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <unistd.h>
 
 /*
@@ -29,13 +30,81 @@
  * to   - this is the "struct silk_exec_state_t" of the instance we switch into
  * from - this is the "struct silk_exec_state_t" of the instance we switch out-of
  */
+#if defined (SILK_CONTEXT__LIBC)
+#define SILK_SWITCH(to, from)  silk_swap_context(&(to), &(from));
+#elif defined (SILK_CONTEXT__MINIMAL_INLINE)
+/*
+ * The inlined variant only pushes the resume address & the frame pointer (which gcc
+ * doesnt allow to be clobbered) on the stack of the silk being swapped-out. every
+ * other register is declared as clobbered so the compiler saves around the switch
+ * only what is live at each call site. the floating-point/vector registers are all
+ * caller-saved by the ABI so they are clobbered just like with a function call.
+ * Notes:
+ * 1) "to" is read into a register before "from" is written, so recycling a silk
+ *    into itself (to == from) still jumps into the fresh context.
+ * 2) x86-64 code may keep data in the 128 bytes red zone below RSP, so we step over
+ *    it before pushing anything.
+ * 3) the compiler's CFI doesnt know about the stack pointer moves done here, so a
+ *    profiler sample taken on one of these few instructions may unwind incorrectly.
+ *    the out-of-line switch (SILK_CONTEXT__MINIMAL) is fully annotated.
+ */
+#if defined (__i386__)
+#define SILK_SWITCH(to, from)                                           \
+    do {                                                                \
+        void    *__to_esp = (to).esp;                                   \
+        void   **__from_esp = &((from).esp);                            \
+        __asm__ __volatile__ (                                          \
+            "call  2f\n\t"                                              \
+            "2:\n\t"                                                    \
+            "addl  $(1f-2b), (%%esp)\n\t"                               \
+            "pushl %%ebp\n\t"                                           \
+            "movl  %%esp, (%1)\n\t"                                     \
+            "movl  %0, %%esp\n\t"                                       \
+            "popl  %%ebp\n\t"                                           \
+            "ret\n\t"                                                   \
+            "1:\n\t"                                                    \
+            : "+a" (__to_esp), "+d" (__from_esp)                        \
+            :                                                           \
+            : "ebx", "ecx", "esi", "edi", "memory", "cc",               \
+              "st", "st(1)", "st(2)", "st(3)", "st(4)", "st(5)",        \
+              "st(6)", "st(7)",                                         \
+              "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",    \
+              "xmm7");                                                  \
+    } while (0);
+#elif defined (__x86_64__)
+#define SILK_SWITCH(to, from)                                           \
+    do {                                                                \
+        void    *__to_rsp = (to).rsp;                                   \
+        void   **__from_rsp = &((from).rsp);                            \
+        __asm__ __volatile__ (                                          \
+            "leaq  -128(%%rsp), %%rsp\n\t"                              \
+            "leaq  1f(%%rip), %%rax\n\t"                                \
+            "pushq %%rax\n\t"                                           \
+            "pushq %%rbp\n\t"                                           \
+            "movq  %%rsp, (%1)\n\t"                                     \
+            "movq  %0, %%rsp\n\t"                                       \
+            "popq  %%rbp\n\t"                                           \
+            "ret\n\t"                                                   \
+            "1:\n\t"                                                    \
+            "leaq  128(%%rsp), %%rsp\n\t"                               \
+            : "+D" (__to_rsp), "+S" (__from_rsp)                        \
+            :                                                           \
+            : "rax", "rbx", "rcx", "rdx", "r8", "r9", "r10", "r11",     \
+              "r12", "r13", "r14", "r15", "memory", "cc",               \
+              "st", "st(1)", "st(2)", "st(3)", "st(4)", "st(5)",        \
+              "st(6)", "st(7)",                                         \
+              "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",    \
+              "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12",        \
+              "xmm13", "xmm14", "xmm15");                               \
+    } while (0);
+#endif
+#elif defined (SILK_CONTEXT__MINIMAL)
 #if defined (__i386__)
 #define SILK_SWITCH(to, from)  silk_swap_stack_context((to).esp, &((from).esp));
 #elif defined (__x86_64__)
-#error "not implemented"
-// it should be of the form:
-#define SILK_SWITCH(to, from)  silk_swap_stack_context(&(to), &(from));
+#define SILK_SWITCH(to, from)  silk_swap_stack_context((to).rsp, &((from).rsp));
 #endif
+#endif // SILK_CONTEXT__MINIMAL
 
 
 /*
@@ -48,13 +117,39 @@ typedef void (*silk_uthread_func_t) (void *_arg);
 /*
  * LIBC API's based context switch
  */
+#ifndef __USE_XOPEN_EXTENDED
 #define __USE_XOPEN_EXTENDED
+#endif
 #include <ucontext.h>
 
 struct silk_exec_state_t {
     ucontext_t   libc_state;
+#if defined (SILK_CONTEXT__LIBC_NO_SIGMASK)
+    /*
+     * once a silk has started running, we switch using the gcc builtin setjmp/longjmp
+     * (which never touch the signal mask) rather than swapcontext(). The ucontext is
+     * used only to start a fresh silk on its stack.
+     */
+    void         *jmp_buf[5];
+    // whether jmp_buf holds a valid context to jump into.
+    bool          is_started;
+#endif
 };
 
+/*
+ * Input:
+ * initial_ctx - the initial context to be created
+ * stack_buf - the buffer to hold the uthread stack.
+ * size - the size (in bytes) of the stack buffer.
+ */
+void silk_create_initial_stack_context(struct silk_exec_state_t *initial_ctx,
+                                       void    (*start_func) (void),
+                                       char     *stack_buf,
+                                       size_t    size);
+
+void silk_swap_context(struct silk_exec_state_t *switch_to,
+                       struct silk_exec_state_t *switch_from);
+
 
 #elif defined (SILK_CONTEXT__MINIMAL)
 
@@ -83,35 +178,127 @@ void silk_create_initial_stack_context(struct silk_exec_state_t *initial_ctx,
                                        char     *stack_buf,
                                        size_t    size);
 
+#if !defined (SILK_CONTEXT__MINIMAL_INLINE)
 void silk_swap_stack_context(void    *switch_to_esp,
                              void   **switch_from_esp);
+#endif
 
 #elif defined (__x86_64__)
 
 /*
  * the context that is saved for a silk uthread when it is swapped-out.
+ * just like IA32, the callee-saved registers (RBX, RBP, R12-R15) are pushed on
+ * the stack of the silk being swapped-out, so only the RSP needs to be here.
+ * BEWARE: the same restriction as IA32 applies - the assembly code uses a pointer
+ * to this structure as if its the pointer to the "rsp" member !!!
  */
 struct silk_exec_state_t {
-    void  *rbx;
     void  *rsp;
-    void  *rbp;
-    void  *r12;
-    void  *r13;
-    void  *r14;
-    void  *r15;
 };
 
 void silk_create_initial_stack_context(struct silk_exec_state_t *initial_ctx,
-                                       silk_uthread_func_t       start_func,
-                                       char                     *stack_buf,
-                                       size_t                    size);
+                                       void    (*start_func) (void),
+                                       char     *stack_buf,
+                                       size_t    size);
 
-void silk_swap_stack_context(struct silk_exec_state_t *switch_to, 
-                             struct silk_exec_state_t *switch_from);
+#if !defined (SILK_CONTEXT__MINIMAL_INLINE)
+void silk_swap_stack_context(void    *switch_to_rsp,
+                             void   **switch_from_rsp);
+#endif
 
 
 #endif // __x86_64__
 
 #endif // SILK_CONTEXT__MINIMAL
 
+
+/*
+ * return the current stack pointer of the caller (which must be inlined into it).
+ */
+static inline __attribute__((always_inline)) void *
+silk_get_stack_pointer(void)
+{
+    void   *sp;
+
+#if defined (__i386__)
+    __asm__ __volatile__ ("movl %%esp, %0" : "=r" (sp));
+#elif defined (__x86_64__)
+    __asm__ __volatile__ ("movq %%rsp, %0" : "=r" (sp));
+#endif
+    return sp;
+}
+
+
+/*
+ * Floating-point state
+ * The context-switch ignores the x87/MMX/SSE/AVX registers. This is fine for C code
+ * bcz the ABI defines all of them as caller-saved (so the compiler saves whatever it
+ * needs around the call to silk_yield()), except for the x87 control word & the MXCSR
+ * control bits (e.g.: rounding mode) which are callee-saved. 
+ * silks that need any of these preserved ask for it when they are allocated 
+ * (see SILK_ALLOC_FLAG__FPU_*) so only they pay for it.
+ */
+#if defined (__i386__) || defined (__x86_64__)
+
+struct silk_fpu_ctrl_t {
+    uint32_t    mxcsr;
+    uint16_t    x87_cw;
+};
+
+/*
+ * the MXCSR bits which are sticky exception status rather than control.
+ */
+#define SILK_FPU_MXCSR_STATUS_MASK    0x3f
+
+struct silk_fpu_state_t {
+    // the control words (saved for any FPU preservation mode)
+    struct silk_fpu_ctrl_t   ctrl;
+    // whether the state was saved since the silk was allocated
+    bool                     is_saved;
+    // the fxsave/xsave area (64 byte aligned). NULL when only control words are preserved
+    void                    *area;
+    // the buffer in which the area is allocated
+    void                    *area_buf;
+};
+
+static inline void
+silk_fpu_save_ctrl(struct silk_fpu_ctrl_t   *ctrl)
+{
+    __asm__ __volatile__ ("fnstcw  %0\n\t"
+                          "stmxcsr %1\n\t"
+                          : "=m" (ctrl->x87_cw), "=m" (ctrl->mxcsr));
+}
+
+static inline void
+silk_fpu_load_ctrl(const struct silk_fpu_ctrl_t   *ctrl)
+{
+    __asm__ __volatile__ ("fldcw   %0\n\t"
+                          "ldmxcsr %1\n\t"
+                          : : "m" (ctrl->x87_cw), "m" (ctrl->mxcsr));
+}
+
+/*
+ * compare the control part of 2 FPU control states (ignoring exception status bits)
+ */
+static inline bool
+silk_fpu_ctrl_equal(const struct silk_fpu_ctrl_t   *a,
+                    const struct silk_fpu_ctrl_t   *b)
+{
+    return ((a->x87_cw == b->x87_cw) &&
+            ((a->mxcsr & ~SILK_FPU_MXCSR_STATUS_MASK) ==
+             (b->mxcsr & ~SILK_FPU_MXCSR_STATUS_MASK)));
+}
+
+/*
+ * detect the best way to save the full FPU state of the CPU.
+ * returns the size of the area required to save it.
+ */
+size_t silk_fpu_init(void);
+
+void silk_fpu_save_full(void    *area);
+
+void silk_fpu_restore_full(const void    *area);
+
+#endif // __i386__ || __x86_64__
+
 #endif // __SILK_CONTEXT_H__
@@ -2,17 +2,40 @@
  * Copyight (C) Eitan Ben-Amos, 2012
  */
 
+#define _GNU_SOURCE // MAP_STACK, madvise(), clock_gettime() & the registers in ucontext_t
 #include <memory.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <errno.h>
-#define __USE_XOPEN_EXTENDED
 #include <unistd.h> 
-#define __USE_MISC
+#include <signal.h>
+#include <ucontext.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h> // MPOL_* for the mbind() syscall (no libnuma)
+#include <sched.h>
+#include <time.h>
 #include "silk.h"
  
 
+/*
+ * the pattern the unused part of the stacks is painted with (SILK_CFG_FLAG_STACK_PROFILE)
+ */
+#define SILK_STACK_PAINT_PATTERN    0x5a5a5a5a5a5a5a5aULL
+/*
+ * the number of bytes below the frame of the painting function that are left unpainted.
+ * they cover the frames of whatever it calls & the x86-64 red zone.
+ */
+#define SILK_STACK_PAINT_GAP        256
+/*
+ * the number of bytes below the stack pointer of a silk that is switched-out, which are
+ * saved along with its frames (SILK_CFG_FLAG_SHARED_STACK). they cover whatever the
+ * context switch pushes (inc. stepping over the x86-64 red zone). the save buffers are
+ * allocated in multiples of it.
+ */
+#define SILK_SHARED_STACK_SLACK     256
+
 
 
 
@@ -36,10 +59,88 @@ silk_eng_is_ready (struct silk_engine_t      *engine)
 }
 
 
+/*
+ * a silk was just pushed to the head of the free list of its stack class. pick the silk it pushed beyond
+ * the warm part of the list so its stack pages are released, unless they already were.
+ * This bounds the release to (at most) one madvise() per freed silk & never touches
+ * the stacks of the silks which are likely to be reused soon.
+ * Note: must be called with the engine lock held.
+ */
+static inline struct silk_t *
+silk__stack_release_pick(struct silk_engine_t       *engine,
+                         struct silk_stack_class_t  *cls)
+{
+    struct silk_t  *s;
+    uint32_t        i = 0;
+
+    if (likely(!(engine->cfg.flags & SILK_CFG_FLAG_STACK_RELEASE_MASK))) {
+        return NULL;
+    }
+    SLIST_FOREACH(s, &cls->free_silks, next_free) {
+        if (i++ == engine->cfg.num_warm_free_silks) {
+            break;
+        }
+    }
+    if ((s == NULL) || s->stack_released) {
+        return NULL;
+    }
+    s->stack_released = true;
+    return s;
+}
+
+/*
+ * return the stack pages of a free silk below the top "num_stack_keep_pages" to the OS.
+ * The silk waits for a msg in silk__main() so its frames are all within the pages we keep.
+ */
+static void
+silk__stack_release(struct silk_engine_t       *engine,
+                    struct silk_t              *s)
+{
+    const struct silk_engine_param_t   *cfg = &engine->cfg;
+    const struct silk_stack_class_t    *cls = silk_get_stack_class_from_id(engine, s->silk_id);
+    void     *stack = silk_get_stack_from_id(engine, s->silk_id);
+    size_t    len;
+    int       rc = -1;
+
+    if (cls->num_stack_pages <= cfg->num_stack_keep_pages) {
+        return;
+    }
+    len = (size_t)(cls->num_stack_pages - cfg->num_stack_keep_pages) * PAGE_SIZE;
+#ifdef MADV_FREE
+    if (cfg->flags & SILK_CFG_FLAG_STACK_RELEASE_LAZY) {
+        rc = madvise(stack, len, MADV_FREE);
+    }
+#endif
+    if (rc != 0) {
+        rc = madvise(stack, len, MADV_DONTNEED);
+    }
+    if (rc != 0) {
+        SILK_WARN("Failed to release the stack of Silk#%d. errno=%d", s->silk_id, errno);
+        return;
+    }
+    engine->num_stack_release++;
+}
+
+/*
+ * zero the silk-local storage of a silk which is done with its allocation
+ */
+static inline void
+silk__local_reset (struct silk_engine_t   *engine,
+                   struct silk_t          *s)
+{
+    if (engine->cfg.local_size > 0) {
+        memset(silk_get_local(s, 0), 0, engine->cfg.local_size);
+    }
+}
+
 static void
 silk_eng_add_free_silk(struct silk_engine_t       *engine,
                        struct silk_t              *s)
 {
+    struct silk_stack_class_t   *cls = silk_get_stack_class_from_id(engine, s->silk_id);
+    struct silk_t   *rs;
+
+    silk__local_reset(engine, s);
     silk__set_state(s, SILK_STATE__FREE);
     pthread_mutex_lock(&engine->mtx);
     engine->num_free_silk++;
@@ -48,10 +149,342 @@ silk_eng_add_free_silk(struct silk_engine_t       *engine,
      * push the terminated silk instance to head of queue. better for CPU cache behavior
      * p.s. : it will also reveal misuse of silk stack after its termination much faster.
      */
-    SLIST_INSERT_HEAD(&engine->free_silks, s, next_free);
+    SLIST_INSERT_HEAD(&cls->free_silks, s, next_free);
+    rs = silk__stack_release_pick(engine, cls);
+    pthread_mutex_unlock(&engine->mtx);
+    if (unlikely(rs != NULL)) {
+        silk__stack_release(engine, rs);
+    }
+}
+
+
+/*
+ * paint the unused part of the stack of the calling silk, from "from" up to a little
+ * below the frame of this function.
+ * it isnt inlined so its frame is below the frames of its caller.
+ */
+static __attribute__((noinline)) void
+silk__stack_paint (void   *from)
+{
+    volatile uint64_t   *p = from;
+    uint64_t            *end = (uint64_t*)(((uintptr_t)&p - SILK_STACK_PAINT_GAP) &
+                                           ~(uintptr_t)(sizeof(*p) - 1));
+
+    for (; p < end; p++) {
+        *p = SILK_STACK_PAINT_PATTERN;
+    }
+}
+
+/*
+ * return the deepest stack usage (in bytes) of a silk since its stack was painted.
+ * The stack grows downward so the deepest byte used is the lowest one which isnt painted.
+ */
+static uint32_t
+silk__stack_depth (struct silk_engine_t   *engine,
+                   struct silk_t          *s)
+{
+    const uint64_t   *p = silk_get_stack_from_id(engine, s->silk_id);
+    const uint64_t   *top = p + silk_get_stack_size_from_id(engine, s->silk_id) / sizeof(*p);
+
+    while ((p < top) && (*p == SILK_STACK_PAINT_PATTERN)) {
+        p++;
+    }
+    return (char*)top - (char*)p;
+}
+
+/*
+ * account the stack usage of a silk that exited (or was killed) to the silk, its stack
+ * class & its entry function.
+ */
+static void
+silk__stack_profile_record (struct silk_engine_t   *engine,
+                            struct silk_t          *s,
+                            uint32_t               depth)
+{
+    struct silk_stack_class_t     *cls = silk_get_stack_class_from_id(engine, s->silk_id);
+    struct silk_stack_profile_t   *prof;
+
+    pthread_mutex_lock(&engine->mtx);
+    if (depth > s->stack_max_depth) {
+        s->stack_max_depth = depth;
+    }
+    if (depth > cls->stack_max_depth) {
+        cls->stack_max_depth = depth;
+    }
+    for (prof = engine->stack_profile;
+         (prof < engine->stack_profile + engine->num_stack_profile) &&
+             (prof->entry_func != s->entry_func);
+         prof++);
+    if (prof == engine->stack_profile + engine->num_stack_profile) {
+        if (engine->num_stack_profile == SILK_STACK_PROFILE_MAX_FUNCS) {
+            engine->num_stack_profile_overflow++;
+            goto out;
+        }
+        engine->num_stack_profile++;
+        prof->entry_func = s->entry_func;
+    }
+    prof->num_exits++;
+    prof->total_depth += depth;
+    if (depth > prof->max_depth) {
+        prof->max_depth = depth;
+    }
+ out:
     pthread_mutex_unlock(&engine->mtx);
 }
 
+/*
+ * the entry function of the calling silk just returned. record its stack usage & paint
+ * back the part it used for the next run.
+ */
+static void
+silk__stack_profile (struct silk_engine_t   *engine,
+                     struct silk_t          *s)
+{
+    const uint32_t   depth = silk__stack_depth(engine, s);
+
+    silk__stack_profile_record(engine, s, depth);
+    silk__stack_paint(silk_get_stack_from_id(engine, s->silk_id) +
+                      silk_get_stack_size_from_id(engine, s->silk_id) - depth);
+}
+
+/*
+ * copy the live part of the stack of a silk, which is switched-out, off its run stack.
+ */
+static void
+silk__stack_save (struct silk_engine_t   *engine,
+                  struct silk_t          *s)
+{
+    char       *top = silk_get_stack_from_id(engine, s->silk_id) +
+        silk_get_stack_size_from_id(engine, s->silk_id);
+    uint32_t    len = top - (char*)s->stack_sp;
+    uint32_t    size;
+    void       *buf;
+
+    if (unlikely(len > s->stack_save_size)) {
+        size = (len + SILK_SHARED_STACK_SLACK - 1) & ~(SILK_SHARED_STACK_SLACK - 1);
+        buf = realloc(s->stack_save_buf, size);
+        if (buf == NULL) {
+            // we cant fail a context switch
+            SILK_ERROR("Failed to allocate %u bytes to save the stack of Silk#%d", size, s->silk_id);
+            abort();
+        }
+        s->stack_save_buf = buf;
+        s->stack_save_size = size;
+    }
+    memcpy(s->stack_save_buf, s->stack_sp, len);
+    s->stack_save_len = len;
+    engine->num_stack_save++;
+    engine->stack_save_bytes += len;
+}
+
+/*
+ * put the stack of a silk back on its run stack, saving the stack of the silk which
+ * owns the run stack first. Must not be called on that run stack.
+ */
+static void
+silk__stack_load (struct silk_engine_t   *engine,
+                  struct silk_t          *s)
+{
+    struct silk_run_stack_t   *rs = &engine->run_stack[s->silk_id % engine->num_run_stacks];
+    char   *top = rs->stack_addr + silk_get_stack_size_from_id(engine, s->silk_id);
+
+    if (rs->owner == s) {
+        return;
+    }
+    if (rs->owner != NULL) {
+        silk__stack_save(engine, rs->owner);
+    }
+    if (s->stack_fresh) {
+        memcpy(top - SILK_SHARED_STACK_BOOT_SIZE, rs->boot_image, SILK_SHARED_STACK_BOOT_SIZE);
+        s->stack_fresh = false;
+    } else {
+        memcpy(top - s->stack_save_len, s->stack_save_buf, s->stack_save_len);
+        engine->num_stack_restore++;
+    }
+    rs->owner = s;
+}
+
+/*
+ * a coarse (i.e.: a few msec resolution) but cheap clock for hibernation (msec)
+ */
+static inline uint64_t
+silk__now_msec (void)
+{
+    struct timespec   ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * save the live part of the stack of a silk waiting for a msg & return its stack pages
+ * to the OS.
+ */
+static void
+silk__hibernate (struct silk_engine_t   *engine,
+                 struct silk_t          *s)
+{
+    int     rc;
+
+    silk__stack_save(engine, s);
+    rc = madvise(silk_get_stack_from_id(engine, s->silk_id),
+                 silk_get_stack_size_from_id(engine, s->silk_id), MADV_DONTNEED);
+    if (rc != 0) {
+        SILK_WARN("Failed to release the stack of Silk#%d. errno=%d", s->silk_id, errno);
+        return;
+    }
+    SILK_DEBUG("Silk#%d hibernated (%u stack bytes)", s->silk_id, s->stack_save_len);
+    s->hibernated = true;
+    engine->num_hibernate++;
+}
+
+/*
+ * put the stack of a hibernated silk back, before it is switched-in.
+ */
+static void
+silk__wakeup (struct silk_engine_t   *engine,
+              struct silk_t          *s)
+{
+    memcpy(s->stack_sp, s->stack_save_buf, s->stack_save_len);
+    s->hibernated = false;
+    engine->num_stack_restore++;
+    engine->num_wakeup++;
+}
+
+/*
+ * hibernate silks which wait for a msg for too long. called by the idle processing, so
+ * only a batch of silks is checked on each pass. the running silk is skipped.
+ */
+static void
+silk__hibernate_scan (struct silk_engine_t   *engine,
+                      struct silk_t          *cur)
+{
+    const uint64_t   now = silk__now_msec();
+    struct silk_t   *s;
+    int    i;
+
+    for (i = 0; i < SILK_HIBERNATE_SCAN_BATCH; i++) {
+        // the pool might have shrunk below the cursor
+        if (engine->hibernate_cursor >= silk_get_num_silk(engine)) {
+            engine->hibernate_cursor = 0;
+        }
+        s = silk_get_ctrl_from_id(engine, engine->hibernate_cursor++);
+        if ((SILK_STATE(s) == SILK_STATE__RUN) && !s->hibernated && (s != cur) &&
+            (now - s->last_run_msec >= engine->cfg.hibernate_msec)) {
+            silk__hibernate(engine, s);
+        }
+    }
+}
+
+/*
+ * The switcher runs on a stack of its own so it can replace the frames on the run stack
+ * of the silk that switched into it (SILK_CFG_FLAG_SHARED_STACK).
+ */
+static void silk__switcher_main (void)
+{
+    struct silk_execution_thread_t         *exec_thr = silk__my_thread_obj();
+    struct silk_engine_t                   *engine = exec_thr->engine;
+    struct silk_t                          *s;
+
+    do {
+        s = exec_thr->switch_to;
+        silk__stack_load(engine, s);
+        SILK_SWITCH(s->exec_state, exec_thr->switcher_state);
+    } while (1);
+}
+
+/*
+ * switch from the calling silk into another one.
+ * with shared run stacks, the silk we switch into might need its stack loaded first.
+ * if it runs on our own run stack, this is done by the switcher.
+ */
+static inline __attribute__((always_inline)) void
+silk__switch (struct silk_engine_t             *engine,
+              struct silk_execution_thread_t   *exec_thr,
+              struct silk_t                    *s,
+              struct silk_t                    *trgt)
+{
+    if (likely(engine->num_run_stacks == 0)) {
+        if (unlikely(engine->cfg.flags & SILK_CFG_FLAG_HIBERNATE)) {
+            s->stack_sp = (char*)silk_get_stack_pointer() - SILK_SHARED_STACK_SLACK;
+            s->last_run_msec = silk__now_msec();
+            if (unlikely(trgt->hibernated)) {
+                silk__wakeup(engine, trgt);
+            }
+        }
+        silk__set_cur_silk(trgt);
+        SILK_SWITCH(trgt->exec_state, s->exec_state);
+        return;
+    }
+    s->stack_sp = (char*)silk_get_stack_pointer() - SILK_SHARED_STACK_SLACK;
+    silk__set_cur_silk(trgt);
+    if (engine->run_stack[trgt->silk_id % engine->num_run_stacks].owner == trgt) {
+        SILK_SWITCH(trgt->exec_state, s->exec_state);
+    } else if ((trgt->silk_id % engine->num_run_stacks) != (s->silk_id % engine->num_run_stacks)) {
+        silk__stack_load(engine, trgt);
+        SILK_SWITCH(trgt->exec_state, s->exec_state);
+    } else {
+        exec_thr->switch_to = trgt;
+        SILK_SWITCH(exec_thr->switcher_state, s->exec_state);
+    }
+}
+
+/*
+ * save the FPU state of a silk being swapped-out. if it changed the FPU control words,
+ * the engine defaults are loaded so silks which dont preserve the FPU state always
+ * run with them.
+ */
+static inline void
+silk__fpu_save(struct silk_execution_thread_t   *exec_thr,
+               struct silk_t                    *s)
+{
+    struct silk_fpu_state_t   *fpu = s->fpu;
+
+    if (s->state & SILK_ALLOC_FLAG__FPU_FULL) {
+        silk_fpu_save_full(fpu->area);
+    }
+    silk_fpu_save_ctrl(&fpu->ctrl);
+    fpu->is_saved = true;
+    if (unlikely(!silk_fpu_ctrl_equal(&fpu->ctrl, &exec_thr->fpu_dflt))) {
+        silk_fpu_load_ctrl(&exec_thr->fpu_dflt);
+    }
+}
+
+/*
+ * restore the FPU state of a silk that was just swapped-in. The control words are
+ * loaded only when they differ from the engine defaults (which are always in effect
+ * when switching from another silk).
+ */
+static inline void
+silk__fpu_restore(struct silk_execution_thread_t   *exec_thr,
+                  struct silk_t                    *s)
+{
+    struct silk_fpu_state_t   *fpu = s->fpu;
+
+    if (unlikely(!fpu->is_saved)) {
+        // the silk was parked before it was allocated so it has no state to restore.
+        return;
+    }
+    if (s->state & SILK_ALLOC_FLAG__FPU_FULL) {
+        silk_fpu_restore_full(fpu->area);
+    } else if (unlikely(!silk_fpu_ctrl_equal(&fpu->ctrl, &exec_thr->fpu_dflt))) {
+        silk_fpu_load_ctrl(&fpu->ctrl);
+    }
+}
+
+/*
+ * a silk which preserved its FPU state ends its life (i.e.: returns or is recycled).
+ * make sure whatever runs next on the CPU gets the engine defaults.
+ */
+static inline void
+silk__fpu_release(struct silk_execution_thread_t   *exec_thr,
+                  struct silk_t                    *s)
+{
+    if (unlikely(s->state & SILK_ALLOC_FLAG__FPU_MASK)) {
+        silk_fpu_load_ctrl(&exec_thr->fpu_dflt);
+        s->state &= ~SILK_ALLOC_FLAG__MASK;
+    }
+}
 
 /*
  * This is the internal entry function of all silks.
@@ -65,26 +498,61 @@ static void silk__main (void) /*__attribute__((no_return))*/
     struct silk_engine_t                   *engine = exec_thr->engine;
     struct silk_msg_t       msg;
     struct silk_t           *s = silk__my_ctrl();
+    bool                    lazy_boot = s->lazy_boot;
 
 
-    SILK_DEBUG("Silk#%d booting...", s->silk_id);
-    assert(SILK_STATE(s) == SILK_STATE__BOOT);
+    if (unlikely(exec_thr->overflow_silk == s)) {
+        /*
+         * the silk overflowed its stack & the SIGSEGV handler restarted it on a clean stack
+         * (see silk__guard_handler()). we're out of the handler now, so pump msgs & let the
+         * TERM path recycle it, just like a killed silk.
+         */
+        SILK_ERROR("Silk#%d overflowed its stack (entry function %p). recycling it",
+                   s->silk_id, s->entry_func);
+        silk_yield(&msg);
+        assert(0); // the TERM path switches into the recycled silk
+    }
+    if (likely(!lazy_boot)) {
+        SILK_DEBUG("Silk#%d booting...", s->silk_id);
+        assert(SILK_STATE(s) == SILK_STATE__BOOT);
 
-    // wait for the BOOT msg
-    silk_yield(&msg);
-    assert(msg.msg == SILK_MSG_BOOT);
+        // wait for the BOOT msg
+        silk_yield(&msg);
+        assert(msg.msg == SILK_MSG_BOOT);
 
-    SILK_DEBUG("Silk#%d processing BOOT msg", s->silk_id);
-    assert(SILK_STATE(s) == SILK_STATE__BOOT);
-    silk__set_state(s, SILK_STATE__FREE);
-    pthread_mutex_lock(&engine->mtx);
-    engine->num_free_silk++;
-    assert(engine->num_free_silk <= engine->cfg.num_silk);
-    pthread_mutex_unlock(&engine->mtx);
+        SILK_DEBUG("Silk#%d processing BOOT msg", s->silk_id);
+        assert(SILK_STATE(s) == SILK_STATE__BOOT);
+    } else {
+        /*
+         * the silk was added when the pool grew & freed without booting. the msg which
+         * switched into it (usually the START msg) is processed below.
+         */
+        SILK_DEBUG("Silk#%d booting lazily", s->silk_id);
+        s->lazy_boot = false;
+    }
+    // the silk runs from the top of a clean stack. paint all of it below us.
+    if (unlikely(engine->cfg.flags & SILK_CFG_FLAG_STACK_PROFILE)) {
+        silk__stack_paint(silk_get_stack_from_id(engine, s->silk_id));
+    }
+    if (likely(!lazy_boot)) {
+        silk__set_state(s, SILK_STATE__FREE);
+        pthread_mutex_lock(&engine->mtx);
+        engine->num_free_silk++;
+        assert(engine->num_free_silk <= engine->cfg.num_silk);
+        pthread_mutex_unlock(&engine->mtx);
+    }
     
     do {
         // wait for the START msg
-        silk_yield(&msg);
+        if (likely(!lazy_boot)) {
+            silk_yield(&msg);
+        } else {
+            memcpy(&msg, &exec_thr->last_msg, sizeof(msg));
+            if (unlikely(msg.flags & SILK_MSG_FLAG__PAYLOAD)) {
+                s->msg_payload = msg.ctx;
+            }
+            lazy_boot = false;
+        }
         /* 
          * handle the 3 possible msgs using "if" rather than "switch" bcz the
          * probability of each is drastically lower than the one checked before hand.
@@ -98,6 +566,11 @@ static void silk__main (void) /*__attribute__((no_return))*/
             s->entry_func(s->entry_func_arg);
             assert((SILK_STATE(s) == SILK_STATE__RUN) ||// usual case
                    (SILK_STATE(s) == SILK_STATE__TERM));// when killed but no yeild called since
+            silk__fpu_release(exec_thr, s);
+            s->arena_used = 0;
+            if (unlikely(engine->cfg.flags & SILK_CFG_FLAG_STACK_PROFILE)) {
+                silk__stack_profile(engine, s);
+            }
 #if 1
             silk_eng_add_free_silk(engine, s);
 #else
@@ -121,6 +594,8 @@ static void silk__main (void) /*__attribute__((no_return))*/
              * we use its stack.
              */
             assert(0); // we can only get here for popin the TERM msg on a silk in state ALLOC.
+        } else if (unlikely(msg.msg == SILK_MSG_NOOP)) {
+            // the engine thread just needed to run on this silk
         } else if (unlikely(msg.msg == SILK_MSG_TERM_THREAD)) {
             SILK_INFO("kernel thread %lu processing TERM msg", exec_thr->id);
             engine->terminate = true;
@@ -134,6 +609,7 @@ static void silk__main (void) /*__attribute__((no_return))*/
         }
     } while (likely(engine->terminate == false));
     SILK_INFO("thread %lu switching back to pthread stack", exec_thr->id);
+    silk__set_cur_silk(NULL);
     SILK_SWITCH(exec_thr->exec_state, s->exec_state);
 }
 
@@ -156,6 +632,19 @@ static void *silk__thread_entry(void *ctx)
     SILK_INFO("Thread starting. id=%lu", exec_thr->id);
     // set the Silk thread object so every thread to hs access to its own
     silk__set_tls(SILK_TLS__THREAD_OBJ, exec_thr);
+    // the FPU control words every silk starts with
+    silk_fpu_save_ctrl(&exec_thr->fpu_dflt);
+    // stack overflows are handled on the alternate signal stack of the thread
+    if (exec_thr->alt_stack != NULL) {
+        stack_t   ss = {
+            .ss_sp = exec_thr->alt_stack,
+            .ss_size = SILK_GUARD_ALT_STACK_SIZE,
+            .ss_flags = 0,
+        };
+        if (sigaltstack(&ss, NULL) != 0) {
+            SILK_ERROR("Failed to set the alternate signal stack. errno=%d", errno);
+        }
+    }
     /*
      * switch into one silk (no matter which) to start processing msgs. from that
      * point onwards, we'll only switch from one silk to another without ever 
@@ -172,21 +661,107 @@ static void *silk__thread_entry(void *ctx)
      * for our execution until we switch into a silk for processng its msg.
      */
     s = silk_get_ctrl_from_id(engine, silk_id);
+    if (engine->num_run_stacks > 0) {
+        silk__stack_load(engine, s);
+    }
+    silk__set_cur_silk(s);
     SILK_SWITCH(s->exec_state, exec_thr->exec_state);
     // we get here only if the engine is terminating !!!
+    if (exec_thr->alt_stack != NULL) {
+        stack_t   ss = {
+            .ss_flags = SS_DISABLE,
+        };
+        sigaltstack(&ss, NULL);
+    }
     SILK_INFO("Thread exiting. id=%lu", exec_thr->id);
     return NULL;
 }
 
+/*
+ * read the CPUs of a NUMA node (SILK_CFG_FLAG_NUMA_BIND). sysfs lists them as ranges,
+ * e.g.: "0-3,8-11". a node without CPUs (e.g.: memory only) cant run an engine.
+ */
+static enum silk_status_e
+silk__numa_node_cpus (uint32_t    node,
+                      cpu_set_t   *cpus)
+{
+    char    path[64], list[1024], *p, *end;
+    long    cpu, last_cpu;
+    FILE    *f;
+
+    CPU_ZERO(cpus);
+    if (node >= SILK_NUMA_MAX_NODES) {
+        return SILK_STAT_INVALID_NUMA_NODE;
+    }
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return SILK_STAT_INVALID_NUMA_NODE;
+    }
+    p = fgets(list, sizeof(list), f);
+    fclose(f);
+    while ((p != NULL) && (*p >= '0') && (*p <= '9')) {
+        cpu = last_cpu = strtol(p, &end, 10);
+        if (*end == '-') {
+            last_cpu = strtol(end + 1, &end, 10);
+        }
+        for (; (cpu <= last_cpu) && (cpu < CPU_SETSIZE); cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+        p = (*end == ',') ? end + 1 : NULL;
+    }
+    return (CPU_COUNT(cpus) > 0) ? SILK_STAT_OK : SILK_STAT_INVALID_NUMA_NODE;
+}
+
+/*
+ * bind a memory range to the NUMA node of the engine (SILK_CFG_FLAG_NUMA_BIND). the range
+ * is trimmed to whole pages, so a part of a structure can be bound. pages which were
+ * already touched are moved to the node.
+ */
+static enum silk_status_e
+silk__numa_bind (struct silk_engine_t   *engine,
+                 void                   *addr,
+                 size_t                 len)
+{
+    unsigned long   nodemask[SILK_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+    uintptr_t       start = ((uintptr_t)addr + PAGE_SIZE - 1) & ~((uintptr_t)PAGE_SIZE - 1);
+    uintptr_t       end = ((uintptr_t)addr + len) & ~((uintptr_t)PAGE_SIZE - 1);
+    uint32_t        node = engine->cfg.numa_node;
+    long            rc;
+
+    if (end <= start) {
+        return SILK_STAT_OK;
+    }
+    memset(nodemask, 0, sizeof(nodemask));
+    nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    // the kernel takes one less than the number of bits in the mask
+    rc = syscall(SYS_mbind, start, end - start, MPOL_BIND, nodemask,
+                 SILK_NUMA_MAX_NODES + 1, MPOL_MF_MOVE);
+    if (rc != 0) {
+        SILK_ERROR("Failed to bind memory to NUMA node %u. errno=%d", node, errno);
+        return SILK_STAT_NUMA_BIND_FAILED;
+    }
+    return SILK_STAT_OK;
+}
+
 enum silk_status_e
 silk_thread_init (struct silk_execution_thread_t        *exec_thr,
                   struct silk_engine_t                  *engine)
 {
+    pthread_attr_t   attr;
+    cpu_set_t        cpus;
     int          rc;
  
 		
     exec_thr->engine = engine;
-    rc = pthread_create(&exec_thr->id, NULL, silk__thread_entry, exec_thr);
+    pthread_attr_init(&attr);
+    // the thread starts on the CPUs of its NUMA node (the node was verified by silk_init())
+    if ((engine->cfg.flags & SILK_CFG_FLAG_NUMA_BIND) &&
+        (silk__numa_node_cpus(engine->cfg.numa_node, &cpus) == SILK_STAT_OK)) {
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    rc = pthread_create(&exec_thr->id, &attr, silk__thread_entry, exec_thr);
+    pthread_attr_destroy(&attr);
     if (rc != 0) {
         return SILK_STAT_THREAD_CREATE_FAILED;
     }
@@ -204,121 +779,718 @@ silk_eng_terminate (struct silk_execution_thread_t       *exec_thr)
 }
 
 /*
- * wait for the internal thread to terminate & only then return. this ensures the
- * caller that once the API returns, it can free whatever resources were bound to
- * the engine.
+ * wait for the internal thread to terminate & only then return. this ensures the
+ * caller that once the API returns, it can free whatever resources were bound to
+ * the engine.
+ */
+enum silk_status_e
+silk_eng_join (struct silk_execution_thread_t                    *exec_thr)
+{
+    int rc;
+    rc = pthread_join(exec_thr->id, NULL);
+    if (rc == 0)
+        return SILK_STAT_OK;
+    return SILK_STAT_THREAD_ERROR;
+}
+
+ 
+
+/*
+ * the number of pages at the top of each stack of a class to populate on init, as set
+ * by the stack commit policy.
+ */
+static inline uint32_t
+silk__stack_commit_pages (const struct silk_engine_param_t   *param,
+                          const struct silk_stack_class_t    *cls)
+{
+    if (param->flags & SILK_CFG_FLAG_STACK_COMMIT_LAZY) {
+        return 0;
+    } else if (param->flags & SILK_CFG_FLAG_STACK_COMMIT_TOP) {
+        return param->num_stack_commit_pages;
+    }
+    return cls->num_stack_pages;
+}
+
+/*
+ * set the stack size classes of the engine (& the total number of silks) from the
+ * configuration. The classes are laid out one after the other in the stack area.
+ */
+static enum silk_status_e
+silk__init_stack_classes (struct silk_engine_t               *engine,
+                          const struct silk_engine_param_t   *param)
+{
+    const struct silk_stack_class_param_t   dflt_class = {
+        .num_stack_pages = param->num_stack_pages,
+        .num_silk = param->num_silk,
+    };
+    const struct silk_stack_class_param_t   *cls_param = param->stack_classes;
+    struct silk_stack_class_t   *cls;
+    silk_id_t   silk_id = 0;
+    // the first stack has a guard below it just like the others (the separator before it)
+    size_t      offset = param->num_stack_seperator_pages * PAGE_SIZE;
+    int         i;
+
+    if (param->num_stack_classes == 0) {
+        engine->num_stack_classes = 1;
+        cls_param = &dflt_class;
+    } else if (param->num_stack_classes <= SILK_MAX_STACK_CLASSES) {
+        engine->num_stack_classes = param->num_stack_classes;
+    } else {
+        return SILK_STAT_INVALID_STACK_CLASS;
+    }
+    for (i = 0; i < engine->num_stack_classes; i++, cls_param++) {
+        cls = &engine->stack_class[i];
+        if (cls_param->num_stack_pages < 1)
+            return SILK_STAT_INVALID_STACK_SIZE;
+        if ((i > 0) && (cls_param->num_stack_pages <= (cls-1)->num_stack_pages))
+            return SILK_STAT_INVALID_STACK_CLASS;
+        if (cls_param->num_silk < 1)
+            return SILK_STAT_INVALID_NUM_SILK;
+        cls->num_stack_pages = cls_param->num_stack_pages;
+        cls->stack_size = cls_param->num_stack_pages * PAGE_SIZE;
+        cls->padded_stack_size = (cls_param->num_stack_pages + param->num_stack_seperator_pages) * PAGE_SIZE;
+        cls->first_silk_id = silk_id;
+        cls->num_silk = cls_param->num_silk;
+        // the stack address is set once the stack area is allocated
+        cls->stack_addr = (void*)offset;
+        SLIST_INIT(&cls->free_silks);
+        silk_id += cls->num_silk;
+        offset += cls->padded_stack_size * cls->num_silk;
+    }
+    engine->cfg.num_silk = silk_id;
+    engine->stack_area_size = offset;
+    if (engine->cfg.num_silk < SILK_MIN_NUM_THREADS)
+        return SILK_STAT_INVALID_NUM_SILK;
+    return SILK_STAT_OK;
+}
+
+/*
+ * set the context of a silk so it starts to run silk__main() from the top of its stack.
+ */
+static void
+silk__init_context (struct silk_engine_t   *engine,
+                    struct silk_t          *s)
+{
+    struct silk_run_stack_t   *rs;
+
+    if (likely(engine->num_run_stacks == 0)) {
+        silk_create_initial_stack_context(&s->exec_state,
+                                          silk__main,
+                                          silk_get_stack_from_id(engine, s->silk_id),
+                                          silk_get_stack_size_from_id(engine, s->silk_id));
+        return;
+    }
+    // its boot frame is copied onto the run stack when it is switched-in
+    rs = &engine->run_stack[s->silk_id % engine->num_run_stacks];
+    memcpy(&s->exec_state, &rs->boot_state, sizeof(s->exec_state));
+    s->stack_fresh = true;
+    if (rs->owner == s) {
+        rs->owner = NULL;
+    }
+}
+
+/*
+ * set the run stacks & the switcher (SILK_CFG_FLAG_SHARED_STACK). they are laid out in
+ * the stack area just like the stacks of the silks would be.
+ */
+static enum silk_status_e
+silk__init_run_stacks (struct silk_engine_t   *engine)
+{
+    const struct silk_stack_class_t   *cls = engine->stack_class;
+    struct silk_run_stack_t   *rs;
+    int    i;
+
+    engine->run_stack = calloc(engine->num_run_stacks, sizeof(*engine->run_stack));
+    if (engine->run_stack == NULL) {
+        return SILK_STAT_ALLOC_FAIL;
+    }
+    for (i = 0, rs = engine->run_stack; i < engine->num_run_stacks; i++, rs++) {
+        rs->stack_addr = cls->stack_addr + i * cls->padded_stack_size;
+        // create the boot frame once & keep a copy for each silk which (re)starts on the stack
+        silk_create_initial_stack_context(&rs->boot_state, silk__main,
+                                          rs->stack_addr, cls->stack_size);
+        memcpy(rs->boot_image, rs->stack_addr + cls->stack_size - SILK_SHARED_STACK_BOOT_SIZE,
+               SILK_SHARED_STACK_BOOT_SIZE);
+    }
+    // the switcher has the stack after the last run stack
+    silk_create_initial_stack_context(&engine->exec_thr.switcher_state, silk__switcher_main,
+                                      cls->stack_addr + i * cls->padded_stack_size,
+                                      cls->stack_size);
+    return SILK_STAT_OK;
+}
+
+/*
+ * populate (i.e.: fault-in) a range of stack pages.
+ * MAP_POPULATE cant be used for this bcz the stacks area is mapped PROT_NONE & only 
+ * the stacks themselves are made writable afterwards.
+ */
+static void
+silk__populate_stack (void     *addr,
+                      size_t   len)
+{
+    volatile char   *p;
+    int    rc = -1;
+
+#ifdef MADV_POPULATE_WRITE
+    rc = madvise(addr, len, MADV_POPULATE_WRITE);
+#endif
+    if (rc != 0) {
+        // an older kernel. touch every page ourselves
+        for (p = addr; p < (char*)addr + len; p += PAGE_SIZE) {
+            *p = 0;
+        }
+    }
+}
+
+/*
+ * return the mmap() flags of the stack memory (the stack area & the stack segments)
+ */
+static int
+silk__stack_mmap_flags (const struct silk_engine_param_t   *param)
+{
+    int    mem_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK;
+
+    /* 
+     * configuration indicate whether to lock the stacks area into memory or 
+     * not. This also requires permissions
+     */
+    if (param->flags & SILK_CFG_FLAG_LOCK_STACK_MEM) {
+        mem_flags |= MAP_LOCKED;
+    }
+    // dont reserve swap space for stack pages which might never be touched
+    if (param->flags & SILK_CFG_FLAG_STACK_COMMIT_LAZY) {
+        mem_flags |= MAP_NORESERVE;
+    }
+    return mem_flags;
+}
+
+/*
+ * make a stack of a class writable & populate its top "commit_pages" pages (stacks grow
+ * downward).
+ */
+static enum silk_status_e
+silk__commit_stack (struct silk_engine_t               *engine,
+                    const struct silk_stack_class_t    *cls,
+                    void                               *addr,
+                    uint32_t                           commit_pages)
+{
+    int    rc;
+
+    // hugetlbfs stacks are already writable (& cant be protected by 4KB pages). the stack
+    // segments the pool grows into have regular pages
+    rc = ((engine->stack_huge_page == SILK_HUGE_PAGE_HUGETLB) && (addr >= engine->stack_addr) &&
+          (addr < engine->stack_addr + engine->stack_area_size)) ? 0 :
+        mprotect(addr, cls->stack_size, PROT_WRITE);
+    if (rc != 0) {
+        SILK_ERROR("Failed to set stack memory protection. errno=%d", errno);
+        return SILK_STAT_STACK_PROTECTION_SCHEME_FAILED;
+    }
+    if (commit_pages > 0) {
+        silk__populate_stack(addr + (cls->num_stack_pages - commit_pages) * PAGE_SIZE,
+                             commit_pages * PAGE_SIZE);
+    }
+    return SILK_STAT_OK;
+}
+
+/*
+ * map an area backed by huge pages (SILK_CFG_FLAG_HUGE_PAGES). hugetlbfs pages are tried
+ * first if the caller allows (the length is rounded-up to the huge page size & updated).
+ * otherwise, or if there are no hugetlbfs pages to reserve, a regular mapping is aligned
+ * to the huge page size (unless its address is fixed) & advised as transparent huge
+ * pages. the kind of pages it got is returned in "huge_page".
+ */
+static void *
+silk__huge_mmap (void                    *addr,
+                 size_t                  *len,
+                 int                     prot,
+                 int                     flags,
+                 bool                    hugetlb,
+                 enum silk_huge_page_e   *huge_page)
+{
+    void      *area, *aligned;
+    size_t    huge_len = (*len + SILK_HUGE_PAGE_SIZE - 1) & ~((size_t)SILK_HUGE_PAGE_SIZE - 1);
+    int       rc;
+
+    *huge_page = SILK_HUGE_PAGE_NONE;
+#ifdef MAP_HUGETLB
+    if (hugetlb && (((uintptr_t)addr & (SILK_HUGE_PAGE_SIZE - 1)) == 0)) {
+        // the huge pages are reserved now, so a fault cant fail later on (SIGBUS)
+        area = mmap(addr, huge_len, prot, (flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+        if (area != MAP_FAILED) {
+            *len = huge_len;
+            *huge_page = SILK_HUGE_PAGE_HUGETLB;
+            return area;
+        }
+        SILK_INFO("No hugetlbfs pages for %zu bytes, falling back to THP. errno=%d", huge_len, errno);
+    }
+#endif
+    if (flags & MAP_FIXED) {
+        area = mmap(addr, *len, prot, flags, -1, 0);
+        if (area == MAP_FAILED) {
+            return area;
+        }
+    } else {
+        // map an extra huge page & trim the area to start on a huge page boundary
+        area = mmap(addr, *len + SILK_HUGE_PAGE_SIZE, prot, flags, -1, 0);
+        if (area == MAP_FAILED) {
+            return area;
+        }
+        aligned = (void*)(((uintptr_t)area + SILK_HUGE_PAGE_SIZE - 1) & ~((uintptr_t)SILK_HUGE_PAGE_SIZE - 1));
+        if (aligned != area) {
+            munmap(area, aligned - area);
+        }
+        munmap(aligned + *len, area + SILK_HUGE_PAGE_SIZE - aligned);
+        area = aligned;
+    }
+#ifdef MADV_HUGEPAGE
+    // this also overrides the no-huge-pages default of MAP_STACK mappings
+    rc = madvise(area, *len, MADV_HUGEPAGE);
+    if (rc == 0) {
+        *huge_page = SILK_HUGE_PAGE_THP;
+    } else {
+        SILK_INFO("Transparent huge pages arent available. errno=%d", errno);
+    }
+#endif
+    return area;
+}
+
+/*
+ * release the silks array of an engine, allocated from the heap or mapped with huge pages.
+ */
+static void
+silk__free_silks (struct silk_engine_t   *engine)
+{
+    if (engine->silks_area_size > 0) {
+        munmap(engine->silks, engine->silks_area_size);
+    } else {
+        free(engine->silks);
+    }
+}
+
+/*
+ * the cache of msg payloads shared by the threads (other than the engine's own) which
+ * use the same slot. a thread picks its slot once, so the caches are rarely contended.
+ */
+static __thread int    silk__payload_slot = -1;
+static int             silk__payload_next_slot;
+
+/*
+ * build the free list of the msg payload pool (in address order, so the payloads are
+ * allocated one after the other).
+ */
+static void
+silk__payload_pool_init (struct silk_engine_t   *engine)
+{
+    void     *payload;
+    int      i;
+
+    for (i = engine->cfg.num_payloads - 1; i >= 0; i--) {
+        payload = engine->payload_addr + i * engine->payload_padded_size;
+        *(void**)payload = engine->payload_free;
+        engine->payload_free = payload;
+    }
+    engine->num_free_payload = engine->cfg.num_payloads;
+    for (i = 0; i < SILK_PAYLOAD_NUM_CACHES; i++) {
+        pthread_mutex_init(&engine->payload_cache[i].mtx, NULL);
+    }
+}
+
+/*
+ * return the payload cache of the calling thread. the engine thread has its own cache
+ * (never locked), while the other threads lock the cache of their slot.
+ */
+static inline struct silk_payload_cache_t *
+silk__payload_cache_lock (struct silk_engine_t   *engine)
+{
+    struct silk_execution_thread_t   *exec_thr = silk__my_thread_obj();
+    struct silk_payload_cache_t      *cache;
+
+    if (likely(exec_thr == &engine->exec_thr)) {
+        return &exec_thr->payload_cache;
+    }
+    if (unlikely(silk__payload_slot < 0)) {
+        silk__payload_slot = __sync_fetch_and_add(&silk__payload_next_slot, 1) % SILK_PAYLOAD_NUM_CACHES;
+    }
+    cache = &engine->payload_cache[silk__payload_slot];
+    pthread_mutex_lock(&cache->mtx);
+    return cache;
+}
+
+static inline void
+silk__payload_cache_unlock (struct silk_engine_t          *engine,
+                            struct silk_payload_cache_t   *cache)
+{
+    if (cache != &engine->exec_thr.payload_cache) {
+        pthread_mutex_unlock(&cache->mtx);
+    }
+}
+
+void *
+silk_payload_alloc (struct silk_engine_t   *engine)
+{
+    struct silk_payload_cache_t   *cache = silk__payload_cache_lock(engine);
+    void     *payload = NULL;
+
+    // refill an empty cache with a batch from the pool
+    if (unlikely(cache->num == 0)) {
+        pthread_mutex_lock(&engine->mtx);
+        while ((cache->num < SILK_PAYLOAD_CACHE_BATCH) && (engine->payload_free != NULL)) {
+            cache->payload[cache->num++] = engine->payload_free;
+            engine->payload_free = *(void**)engine->payload_free;
+            engine->num_free_payload--;
+        }
+        pthread_mutex_unlock(&engine->mtx);
+    }
+    if (likely(cache->num > 0)) {
+        payload = cache->payload[--cache->num];
+    }
+    silk__payload_cache_unlock(engine, cache);
+    return payload;
+}
+
+void
+silk_payload_free (struct silk_engine_t   *engine,
+                   void                   *payload)
+{
+    struct silk_payload_cache_t   *cache = silk__payload_cache_lock(engine);
+    void     *p;
+    int      i;
+
+    assert((payload >= engine->payload_addr) &&
+           (payload < engine->payload_addr + engine->cfg.num_payloads * engine->payload_padded_size));
+    /*
+     * return a batch of a full cache to the pool. we return the ones freed first & keep
+     * the recently freed (cache-hot) ones for the next allocations.
+     */
+    if (unlikely(cache->num == SILK_PAYLOAD_CACHE_SIZE)) {
+        pthread_mutex_lock(&engine->mtx);
+        for (i = 0; i < SILK_PAYLOAD_CACHE_BATCH; i++) {
+            p = cache->payload[i];
+            *(void**)p = engine->payload_free;
+            engine->payload_free = p;
+        }
+        engine->num_free_payload += SILK_PAYLOAD_CACHE_BATCH;
+        pthread_mutex_unlock(&engine->mtx);
+        memmove(cache->payload, cache->payload + SILK_PAYLOAD_CACHE_BATCH,
+                (SILK_PAYLOAD_CACHE_SIZE - SILK_PAYLOAD_CACHE_BATCH) * sizeof(cache->payload[0]));
+        cache->num -= SILK_PAYLOAD_CACHE_BATCH;
+    }
+    cache->payload[cache->num++] = payload;
+    silk__payload_cache_unlock(engine, cache);
+}
+
+/*
+ * free the payload of the last msg a silk received (it is done with it)
  */
-enum silk_status_e
-silk_eng_join (struct silk_execution_thread_t                    *exec_thr)
+static inline void
+silk__msg_payload_release (struct silk_engine_t   *engine,
+                           struct silk_t          *s)
 {
-    int rc;
-    rc = pthread_join(exec_thr->id, NULL);
-    if (rc == 0)
-        return SILK_STAT_OK;
-    return SILK_STAT_THREAD_ERROR;
+    if (unlikely(s->msg_payload != NULL)) {
+        silk_payload_free(engine, s->msg_payload);
+        s->msg_payload = NULL;
+    }
 }
 
- 
+static enum silk_status_e silk__guard_install(void);
+static void silk__guard_uninstall(void);
 
 enum silk_status_e
 silk_init (struct silk_engine_t               *engine,
            const struct silk_engine_param_t   *param)
 {
     enum silk_status_e     ret;
-    size_t                 stack_size;
     int                    mem_flags;
     void                   *addr;
     struct silk_t          *s;
+    struct silk_stack_class_t   *cls;
+    uint32_t               commit_pages, num_stacks;
+    bool                   hugetlb;
+    cpu_set_t              numa_cpus;
     int                    i, rc;
  
 
-    if (param->num_stack_pages < 1)
-        return SILK_STAT_INVALID_STACK_SIZE;
-    if (param->num_silk < SILK_MIN_NUM_THREADS)
-        return SILK_STAT_INVALID_NUM_SILK;
-
+    // the groups of fields would share cache lines otherwise
+    if (((uintptr_t)engine & (SILK_CACHE_LINE_SIZE - 1)) != 0)
+        return SILK_STAT_ENGINE_MISALIGNED;
     memset(engine, 0, sizeof(*engine));
     memcpy(&engine->cfg, param, sizeof(engine->cfg));
+    ret = silk__init_stack_classes(engine, param);
+    if (ret != SILK_STAT_OK)
+        return ret;
+    // the stack memory policies must fit the smallest class
+    if ((param->flags & SILK_CFG_FLAG_STACK_COMMIT_MASK) == SILK_CFG_FLAG_STACK_COMMIT_MASK)
+        return SILK_STAT_INVALID_STACK_COMMIT_POLICY;
+    if ((param->flags & SILK_CFG_FLAG_STACK_COMMIT_TOP) &&
+        (param->num_stack_commit_pages > engine->stack_class[0].num_stack_pages))
+        return SILK_STAT_INVALID_STACK_COMMIT_POLICY;
+    if ((param->flags & SILK_CFG_FLAG_STACK_RELEASE_MASK) &&
+        ((param->num_stack_keep_pages < 1) ||
+         (param->num_stack_keep_pages > engine->stack_class[0].num_stack_pages) ||
+         (param->num_warm_free_silks < 1)))
+        return SILK_STAT_INVALID_STACK_RELEASE_POLICY;
+    // released stack pages read back as zeros, so they would look used
+    if ((param->flags & SILK_CFG_FLAG_STACK_RELEASE_MASK) &&
+        (param->flags & SILK_CFG_FLAG_STACK_PROFILE))
+        return SILK_STAT_INVALID_STACK_RELEASE_POLICY;
+    // locked pages cant be released & released pages would look used when profiling
+    if ((param->flags & SILK_CFG_FLAG_HIBERNATE) &&
+        ((param->flags & (SILK_CFG_FLAG_LOCK_STACK_MEM | SILK_CFG_FLAG_STACK_PROFILE)) ||
+         (param->hibernate_msec < 1)))
+        return SILK_STAT_INVALID_HIBERNATE_POLICY;
+    if (param->flags & SILK_CFG_FLAG_SHARED_STACK) {
+        if ((engine->num_stack_classes != 1) ||
+            (param->flags & (SILK_CFG_FLAG_STACK_RELEASE_MASK | SILK_CFG_FLAG_STACK_PROFILE)) ||
+            (param->num_run_stacks < 1) || (param->num_run_stacks > engine->cfg.num_silk))
+            return SILK_STAT_INVALID_SHARED_STACK;
+        if (param->flags & SILK_CFG_FLAG_HIBERNATE)
+            return SILK_STAT_INVALID_HIBERNATE_POLICY;
+        // a stack per run stack & one for the switcher (after the guard below the first one)
+        engine->num_run_stacks = param->num_run_stacks;
+        engine->stack_area_size = (uintptr_t)engine->stack_class[0].stack_addr +
+            (param->num_run_stacks + 1) * engine->stack_class[0].padded_stack_size;
+    }
+    // the separator pages are the guards
+    if ((param->flags & SILK_CFG_FLAG_STACK_GUARD) && (param->num_stack_seperator_pages < 1))
+        return SILK_STAT_INVALID_STACK_GUARD;
+    if ((param->payload_size > 0) != (param->num_payloads > 0))
+        return SILK_STAT_INVALID_PAYLOAD_POOL;
+    // the pool grows into stack segments of a single class
+    if (param->max_silk == 0) {
+        engine->cfg.max_silk = engine->cfg.num_silk;
+    }
+    if (engine->cfg.num_grow_silks == 0) {
+        engine->cfg.num_grow_silks = SILK_DFLT_GROW_SILKS;
+    }
+    if ((engine->cfg.max_silk < engine->cfg.num_silk) || (engine->cfg.max_silk > SILK_MAX_NUM_SILK))
+        return SILK_STAT_INVALID_POOL_GROWTH;
+    if ((engine->cfg.max_silk > engine->cfg.num_silk) &&
+        ((param->num_stack_classes > 0) || (param->flags & SILK_CFG_FLAG_SHARED_STACK)))
+        return SILK_STAT_INVALID_POOL_GROWTH;
+    // locked stacks cant be released
+    if ((param->flags & SILK_CFG_FLAG_POOL_SHRINK) && (param->flags & SILK_CFG_FLAG_LOCK_STACK_MEM))
+        return SILK_STAT_INVALID_POOL_GROWTH;
+    /*
+     * each silk booted below takes 2 msgs. the grown ones boot lazily, but a recycled silk
+     * is sent a BOOT msg, so the queue is sized for the silks the pool may grow to.
+     */
+    if (param->msg_queue_size == 0) {
+        engine->cfg.msg_queue_size = SILK_DFLT_MSG_QUEUE_SIZE;
+        while ((engine->cfg.msg_queue_size < 2 * (uint64_t)engine->cfg.max_silk) &&
+               (engine->cfg.msg_queue_size < (1U << 31))) {
+            engine->cfg.msg_queue_size <<= 1;
+        }
+    }
+    if ((engine->cfg.msg_queue_size & (engine->cfg.msg_queue_size - 1)) ||
+        (engine->cfg.msg_queue_size < 2 * (uint64_t)engine->cfg.max_silk))
+        return SILK_STAT_INVALID_MSG_QUEUE_SIZE;
+    engine->num_boot_silk = engine->cfg.num_silk;
+    engine->silk_size = (sizeof(struct silk_t) + engine->cfg.local_size + SILK_CACHE_LINE_SIZE - 1) &
+        ~((size_t)SILK_CACHE_LINE_SIZE - 1);
+    if (engine->cfg.max_silk > engine->cfg.num_silk) {
+        engine->num_stack_segs = (engine->cfg.max_silk - engine->cfg.num_silk + SILK_STACK_SEG_SILKS - 1) /
+            SILK_STACK_SEG_SILKS;
+        // a power of 2, so the segment of a stack address is found by masking it
+        engine->stack_seg_size = PAGE_SIZE;
+        while (engine->stack_seg_size < SILK_STACK_SEG_OFFSET(engine) +
+               SILK_STACK_SEG_SILKS * engine->stack_class[0].padded_stack_size) {
+            engine->stack_seg_size <<= 1;
+        }
+    }
+    if (param->flags & SILK_CFG_FLAG_NUMA_BIND) {
+        ret = silk__numa_node_cpus(param->numa_node, &numa_cpus);
+        if (ret != SILK_STAT_OK)
+            return ret;
+    }
+
     engine->terminate = false;
     engine->num_free_silk = 0;
     pthread_mutex_init(&engine->mtx,NULL);
-    SLIST_INIT(&engine->free_silks);
+    engine->fpu_area_size = silk_fpu_init();
 
     /*
      * allocate memory for stacks
      * memory layout would be
-     * |stack for uthread 0 | unmapped (protection) pages | stack for uthread 1 | unmapped (protection) pages | ….
+     * | unmapped (protection) pages | stack for uthread 0 | unmapped (protection) pages | stack for uthread 1 | ….
      * all memory is initially allocated as "No Access" & only the alowed 
      * areas will be allowed on top of that.
+     * the stacks of each size class follow the ones of the previous (smaller) class.
+     * with shared run stacks, the area has just the run stacks & the switcher stack.
      */
-    stack_size = SILK_PADDED_STACK(param) * param->num_silk;
-    mem_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK;
+    mem_flags = silk__stack_mmap_flags(param);
     if (param->stack_addr != NULL) {
         mem_flags |= MAP_FIXED;
     }
-    /* 
-     * configuration indicate whether to lock the stacks area into memory or 
-     * not. This also requires permissions
-     */
-    if (param->flags & SILK_CFG_FLAG_LOCK_STACK_MEM) {
-        mem_flags |= MAP_LOCKED;
+    if (param->flags & SILK_CFG_FLAG_HUGE_PAGES) {
+        /*
+         * hugetlbfs pages can only be protected & released as a whole, so the stacks must
+         * be consecutive & kept. the stacks are then the entire area, so its mapped writable.
+         */
+        hugetlb = (param->num_stack_seperator_pages == 0) &&
+            !(param->flags & (SILK_CFG_FLAG_STACK_RELEASE_MASK | SILK_CFG_FLAG_HIBERNATE));
+        engine->stack_addr = silk__huge_mmap(param->stack_addr, &engine->stack_area_size, 
+                                             hugetlb ? PROT_READ | PROT_WRITE : PROT_NONE,
+                                             mem_flags, hugetlb, &engine->stack_huge_page);
+    } else {
+        engine->stack_addr = mmap(param->stack_addr, engine->stack_area_size, PROT_NONE, 
+                                  mem_flags, -1 /* ignored*/, 0);
     }
-    mem_flags |= MAP_POPULATE;// TODO: consider this as config param as it consumes lots of memory. will be meaningfull only if terminated Silks are pushed to the head of the free Silk queue.
-    // TODO: what about MAP__NORESERVE to save swap space?
-    // TODO: x86 stack grows downward - so we probably need a protection page before the first stack area.
-    engine->stack_addr = mmap(param->stack_addr, stack_size, PROT_NONE, 
-                              mem_flags, -1 /* ignored*/, 0);
     if (engine->stack_addr == MAP_FAILED) {
         SILK_ERROR("Failed to allocate stack memory area. errno=%d", errno);
         ret = SILK_STAT_STACK_ALLOC_FAILED;
         goto stack_alloc_fail;
     }
+    // bind the stacks before they are populated below
+    if (param->flags & SILK_CFG_FLAG_NUMA_BIND) {
+        ret = silk__numa_bind(engine, engine->stack_addr, engine->stack_area_size);
+        if (ret != SILK_STAT_OK) {
+            goto stack_bind_fail;
+        }
+    }
     // set each Silk instance stack area to PROT_WRITE
-    for (i=0, addr=engine->stack_addr;
-         i < param->num_silk;
-         i++, addr += SILK_PADDED_STACK(param)) {
-        rc = mprotect(addr, param->num_stack_pages * PAGE_SIZE, PROT_WRITE);
-        if (rc != 0) {
-            SILK_ERROR("Failed to set stack memory protection. errno=%d",
-                       errno);
-            ret = SILK_STAT_STACK_PROTECTION_SCHEME_FAILED;
-            goto stack_prot_fail;
+    for (cls = engine->stack_class; cls < engine->stack_class + engine->num_stack_classes; cls++) {
+        cls->stack_addr = engine->stack_addr + (uintptr_t)cls->stack_addr;
+        commit_pages = silk__stack_commit_pages(param, cls);
+        num_stacks = (engine->num_run_stacks > 0) ? engine->num_run_stacks + 1 : cls->num_silk;
+        for (i=0, addr=cls->stack_addr;
+             i < num_stacks;
+             i++, addr += cls->padded_stack_size) {
+            ret = silk__commit_stack(engine, cls, addr, commit_pages);
+            if (ret != SILK_STAT_OK) {
+                goto stack_prot_fail;
+            }
+        }
+    }
+
+    if (engine->num_run_stacks > 0) {
+        ret = silk__init_run_stacks(engine);
+        if (ret != SILK_STAT_OK) {
+            goto run_stack_alloc_fail;
+        }
+    }
+
+    // the stack segments are reserved as the pool grows into them
+    if (engine->num_stack_segs > 0) {
+        engine->stack_seg = calloc(engine->num_stack_segs, sizeof(*engine->stack_seg));
+        if (engine->stack_seg == NULL) {
+            ret = SILK_STAT_ALLOC_FAIL;
+            goto stack_seg_alloc_fail;
         }
     }
 
-    // allocate per silk instance context information
-    engine->silks = calloc(param->num_silk, sizeof(*engine->silks));
+    /*
+     * allocate per silk instance context information. the silks the pool may grow to are
+     * reserved as well, so the array never moves.
+     */
+    if ((param->flags & (SILK_CFG_FLAG_HUGE_PAGES | SILK_CFG_FLAG_NUMA_BIND)) ||
+        (engine->cfg.max_silk > engine->cfg.num_silk)) {
+        // a mapping of its own, so it can have huge pages, be bound to a node & be committed lazily
+        engine->silks_area_size = (engine->cfg.max_silk * engine->silk_size + PAGE_SIZE - 1) &
+            ~((size_t)PAGE_SIZE - 1);
+        if (param->flags & SILK_CFG_FLAG_HUGE_PAGES) {
+            engine->silks = silk__huge_mmap(NULL, &engine->silks_area_size, PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS,
+                                            true, &engine->silks_huge_page);
+        } else {
+            engine->silks = mmap(NULL, engine->silks_area_size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        }
+        if (engine->silks == MAP_FAILED) {
+            engine->silks = NULL;
+            engine->silks_area_size = 0;
+        }
+    } else if (posix_memalign((void**)&engine->silks, SILK_CACHE_LINE_SIZE,
+                              engine->cfg.num_silk * engine->silk_size) == 0) {
+        // the hot part of each silk must start a cache line
+        memset(engine->silks, 0, engine->cfg.num_silk * engine->silk_size);
+    } else {
+        engine->silks = NULL;
+    }
     if (engine->silks == NULL) {
         ret = SILK_STAT_ALLOC_FAIL;
         goto silk_state_alloc_fail;
     }
 
+    // the arenas are touched only by the silks using them
+    if (param->num_arena_pages > 0) {
+        engine->arena_size = param->num_arena_pages * PAGE_SIZE;
+        engine->arena_addr = mmap(NULL, engine->cfg.max_silk * engine->arena_size,
+                                  PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (engine->arena_addr == MAP_FAILED) {
+            SILK_ERROR("Failed to allocate the arenas. errno=%d", errno);
+            engine->arena_addr = NULL;
+            ret = SILK_STAT_ALLOC_FAIL;
+            goto arena_alloc_fail;
+        }
+    }
+
+    if (param->num_payloads > 0) {
+        engine->payload_padded_size = (param->payload_size + SILK_PAYLOAD_ALIGN - 1) &
+            ~((size_t)SILK_PAYLOAD_ALIGN - 1);
+        engine->payload_addr = mmap(NULL, param->num_payloads * engine->payload_padded_size,
+                                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (engine->payload_addr == MAP_FAILED) {
+            SILK_ERROR("Failed to allocate the msg payloads. errno=%d", errno);
+            engine->payload_addr = NULL;
+            ret = SILK_STAT_ALLOC_FAIL;
+            goto payload_alloc_fail;
+        }
+    }
+
     // initialize the msg queue object
-    ret = silk_sched_init(&engine->msg_sched);
+    ret = silk_sched_init(&engine->msg_sched, engine->cfg.msg_queue_size);
     if (ret != SILK_STAT_OK) {
         goto msg_q_init_fail;
     }
 
+    // the silks array wasnt touched yet, but the queue indexes are embedded in the engine
+    if (param->flags & SILK_CFG_FLAG_NUMA_BIND) {
+        ret = silk__numa_bind(engine, engine->silks, engine->silks_area_size);
+        if (ret == SILK_STAT_OK) {
+            ret = silk__numa_bind(engine, &engine->msg_sched, sizeof(engine->msg_sched));
+        }
+        if (ret == SILK_STAT_OK) {
+            ret = silk__numa_bind(engine, engine->msg_sched.msgs,
+                                  engine->cfg.msg_queue_size * sizeof(*engine->msg_sched.msgs));
+        }
+        if ((ret == SILK_STAT_OK) && (engine->arena_addr != NULL)) {
+            ret = silk__numa_bind(engine, engine->arena_addr,
+                                  engine->cfg.max_silk * engine->arena_size);
+        }
+        if ((ret == SILK_STAT_OK) && (engine->payload_addr != NULL)) {
+            ret = silk__numa_bind(engine, engine->payload_addr,
+                                  engine->cfg.num_payloads * engine->payload_padded_size);
+        }
+        if (ret != SILK_STAT_OK) {
+            goto numa_bind_fail;
+        }
+    }
+    // the free list touches every payload, so its built once the pool is bound
+    silk__payload_pool_init(engine);
+
     // initialize per silk control & set context to the internal entry function
-    for (i=0, addr=engine->stack_addr, s=engine->silks;
-         i < param->num_silk;
-         i++, addr += SILK_PADDED_STACK(param), s++) {
+    for (i=0, cls=engine->stack_class, addr=cls->stack_addr;
+         i < engine->cfg.num_silk;
+         i++, addr += cls->padded_stack_size) {
+        if (i == cls->first_silk_id + cls->num_silk) {
+            cls++;
+            addr = cls->stack_addr;
+        }
+        s = silk_get_ctrl_from_id(engine, i);
         // chain the silk instance into the free list. we chain them by their silk_ID :)
-        if (i == 0) {
-            SLIST_INSERT_HEAD(&engine->free_silks, s, next_free);
+        if (i == cls->first_silk_id) {
+            SLIST_INSERT_HEAD(&cls->free_silks, s, next_free);
         } else {
-            SLIST_INSERT_AFTER(s-1, s, next_free);
+            SLIST_INSERT_AFTER(silk_get_ctrl_from_id(engine, i - 1), s, next_free);
         }
         // mark the silk control state as in BOOT phase
-        silk__set_state(&engine->silks[i], SILK_STATE__BOOT);
+        silk__set_state(s, SILK_STATE__BOOT);
         // initialize the unique silk-ID within the silk control object
-        engine->silks[i].silk_id = i;
-        assert(addr == silk_get_stack_from_id(engine, i));
+        s->silk_id = i;
+        s->stack_class = cls - engine->stack_class;
+        assert((engine->num_run_stacks > 0) || (addr == silk_get_stack_from_id(engine, i)));
         // initialize stack context for each silk instance
-        silk_create_initial_stack_context(&s->exec_state,
-                                          silk__main,
-                                          addr,//silk_get_stack_from_id(engine, msg.silk_id),
-                                          SILK_USEABLE_STACK(&engine->cfg));
+        silk__init_context(engine, s);
         /*
          * ask each silk to boot into the place they all wait for msgs
          * The first msg causes the scheduler to switch into it. it then runs from the 
@@ -341,7 +1513,23 @@ silk_init (struct silk_engine_t               *engine,
             assert(ret == SILK_STAT_OK);
         }
     }
-    assert(_silk_sched_get_q_size(&engine->msg_sched) == 2*param->num_silk-1);
+    assert(_silk_sched_get_q_size(&engine->msg_sched) == 2*engine->cfg.num_silk-1);
+
+    // stack overflows are handled on an alternate signal stack of the engine thread
+    if (param->flags & SILK_CFG_FLAG_STACK_GUARD) {
+        engine->exec_thr.alt_stack = mmap(NULL, SILK_GUARD_ALT_STACK_SIZE, PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (engine->exec_thr.alt_stack == MAP_FAILED) {
+            SILK_ERROR("Failed to allocate the alternate signal stack. errno=%d", errno);
+            engine->exec_thr.alt_stack = NULL;
+            ret = SILK_STAT_ALLOC_FAIL;
+            goto alt_stack_alloc_fail;
+        }
+        ret = silk__guard_install();
+        if (ret != SILK_STAT_OK) {
+            goto guard_install_fail;
+        }
+    }
     
     // let the thread execution start
     ret = silk_thread_init(&engine->exec_thr, engine);
@@ -360,12 +1548,34 @@ silk_init (struct silk_engine_t               *engine,
     return SILK_STAT_OK;
 
  thread_init_fail:
+    if (param->flags & SILK_CFG_FLAG_STACK_GUARD) {
+        silk__guard_uninstall();
+    }
+ guard_install_fail:
+    if (engine->exec_thr.alt_stack != NULL) {
+        munmap(engine->exec_thr.alt_stack, SILK_GUARD_ALT_STACK_SIZE);
+    }
+ alt_stack_alloc_fail:
+ numa_bind_fail:
     silk_sched_terminate(&engine->msg_sched);
  msg_q_init_fail:
-    free(engine->silks);
+    if (engine->payload_addr != NULL) {
+        munmap(engine->payload_addr, engine->cfg.num_payloads * engine->payload_padded_size);
+    }
+ payload_alloc_fail:
+    if (engine->arena_addr != NULL) {
+        munmap(engine->arena_addr, engine->cfg.max_silk * engine->arena_size);
+    }
+ arena_alloc_fail:
+    silk__free_silks(engine);
  silk_state_alloc_fail:
+    free(engine->stack_seg);
+ stack_seg_alloc_fail:
+    free(engine->run_stack);
+ run_stack_alloc_fail:
  stack_prot_fail:
-    rc = munmap(param->stack_addr, stack_size);
+ stack_bind_fail:
+    rc = munmap(engine->stack_addr, engine->stack_area_size);
     if (rc != 0) {
         SILK_ERROR("Failed to unmap stack area memory. errno=%d", errno);
         /* were already in error handling path - continue as if no error */
@@ -377,6 +1587,293 @@ silk_init (struct silk_engine_t               *engine,
 }
 
 
+/*
+ * return a terminated silk to the free list & set it to boot again from a clean stack.
+ * the BOOT msg which lets it run until it awaits the START msg is sent, but switching into
+ * it is up to the caller.
+ */
+static void
+silk__recycle (struct silk_engine_t             *engine,
+               struct silk_execution_thread_t   *exec_thr,
+               struct silk_t                    *s)
+{
+    struct silk_stack_class_t   *cls = silk_get_stack_class_from_id(engine, s->silk_id);
+    struct silk_t               *rs;
+    enum silk_status_e           ret;
+
+    silk__fpu_release(exec_thr, s);
+    s->arena_used = 0;
+    silk__local_reset(engine, s);
+    silk__msg_payload_release(engine, s);
+    // its stack is rebuilt from scratch (whether it was hibernated or not) & booted by msgs
+    s->hibernated = false;
+    s->lazy_boot = false;
+    // its stack is painted again when it boots
+    if (unlikely(engine->cfg.flags & SILK_CFG_FLAG_STACK_PROFILE)) {
+        silk__stack_profile_record(engine, s, silk__stack_depth(engine, s));
+    }
+    silk__set_state(s, SILK_STATE__BOOT);
+    SLIST_INSERT_HEAD(&cls->free_silks, s, next_free);
+    if (unlikely(engine->cfg.flags & SILK_CFG_FLAG_STACK_RELEASE_MASK)) {
+        pthread_mutex_lock(&engine->mtx);
+        rs = silk__stack_release_pick(engine, cls);
+        pthread_mutex_unlock(&engine->mtx);
+        if (rs != NULL) {
+            silk__stack_release(engine, rs);
+        }
+    }
+    // initialize stack context bcz the silk should start from a clean stack.
+    silk__init_context(engine, s);
+    // let the re-initialized silk to run till it awaits the START msg
+    ret = silk_send_msg_code(engine, SILK_MSG_BOOT, s->silk_id);
+    assert(ret == SILK_STAT_OK);
+}
+
+/*
+ * reserve a segment of the stacks the pool grows into (see "stack_seg"). a larger range is
+ * mapped & trimmed so the segment is aligned to its size. its header page is written & made
+ * read-only, while the stacks stay PROT_NONE until they are committed.
+ */
+static enum silk_status_e
+silk__stack_seg_reserve (struct silk_engine_t   *engine,
+                         uint32_t               seg)
+{
+    const size_t   size = engine->stack_seg_size;
+    struct silk_stack_seg_t   *hdr;
+    void     *area, *aligned;
+    enum silk_status_e   ret;
+
+    area = mmap(NULL, 2 * size, PROT_NONE, silk__stack_mmap_flags(&engine->cfg), -1, 0);
+    if (area == MAP_FAILED) {
+        SILK_ERROR("Failed to reserve stack segment %u. errno=%d", seg, errno);
+        return SILK_STAT_STACK_ALLOC_FAILED;
+    }
+    aligned = (void*)(((uintptr_t)area + size - 1) & ~((uintptr_t)size - 1));
+    if (aligned != area) {
+        munmap(area, aligned - area);
+    }
+    munmap(aligned + size, area + size - aligned);
+    hdr = aligned;
+    if (mprotect(hdr, PAGE_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        SILK_ERROR("Failed to set stack segment protection. errno=%d", errno);
+        ret = SILK_STAT_STACK_PROTECTION_SCHEME_FAILED;
+        goto fail;
+    }
+    hdr->first_silk_id = engine->num_boot_silk + seg * SILK_STACK_SEG_SILKS;
+    if (mprotect(hdr, PAGE_SIZE, PROT_READ) != 0) {
+        SILK_ERROR("Failed to set stack segment protection. errno=%d", errno);
+        ret = SILK_STAT_STACK_PROTECTION_SCHEME_FAILED;
+        goto fail;
+    }
+    if (engine->cfg.flags & SILK_CFG_FLAG_NUMA_BIND) {
+        ret = silk__numa_bind(engine, aligned, size);
+        if (ret != SILK_STAT_OK) {
+            goto fail;
+        }
+    }
+    engine->stack_seg[seg] = aligned;
+    SILK_DEBUG("reserved stack segment %u at %p", seg, aligned);
+    return SILK_STAT_OK;
+
+ fail:
+    munmap(aligned, size);
+    return ret;
+}
+
+/*
+ * add up to "num_grow_silks" silks at the end of the pool. their control blocks were
+ * reserved by silk_init() & their stacks are committed now (in their segment, which is
+ * reserved if needed). they are freed without BOOT msgs (the queue might not have room for
+ * them): each boots lazily, when the first msg for it is popped (see silk__main()).
+ * Note: must be called with the engine lock held.
+ */
+static enum silk_status_e
+silk__pool_grow (struct silk_engine_t   *engine)
+{
+    struct silk_stack_class_t   *cls = engine->stack_class;
+    const uint32_t   commit_pages = silk__stack_commit_pages(&engine->cfg, cls);
+    const silk_id_t  first = engine->cfg.num_silk;
+    uint32_t   num = engine->cfg.max_silk - first;
+    struct silk_t    *s;
+    enum silk_status_e   ret = SILK_STAT_NO_FREE_SILK;
+    uint32_t   seg;
+    int    i;
+
+    if (num > engine->cfg.num_grow_silks) {
+        num = engine->cfg.num_grow_silks;
+    }
+    // add the silks whose stacks were committed (if not all)
+    for (i = 0; i < num; i++) {
+        seg = (first + i - engine->num_boot_silk) / SILK_STACK_SEG_SILKS;
+        if (engine->stack_seg[seg] == NULL) {
+            ret = silk__stack_seg_reserve(engine, seg);
+            if (ret != SILK_STAT_OK) {
+                break;
+            }
+        }
+        ret = silk__commit_stack(engine, cls, silk__stack_seg_addr(engine, first + i), commit_pages);
+        if (ret != SILK_STAT_OK) {
+            break;
+        }
+    }
+    if (i == 0) {
+        return ret;
+    }
+    num = i;
+    /*
+     * the control blocks are zeroed (never used or cleared when the pool shrank). they are
+     * beyond the published pool size, so their IDs arent valid yet (see silk_get_num_silk())
+     */
+    for (i = num - 1; i >= 0; i--) {
+        s = silk__ctrl_addr(engine, first + i);
+        s->silk_id = first + i;
+        s->stack_class = 0;
+        s->lazy_boot = true;
+        silk__set_state(s, SILK_STATE__FREE);
+        // the grown silks never share run stacks
+        silk_create_initial_stack_context(&s->exec_state, silk__main,
+                                          silk__stack_seg_addr(engine, first + i), cls->stack_size);
+        // the lower silk IDs are allocated first
+        SLIST_INSERT_HEAD(&cls->free_silks, s, next_free);
+    }
+    // publish them once initialized. the engine thread reads the sizes without the lock
+    __atomic_store_n(&cls->num_silk, cls->num_silk + num, __ATOMIC_RELEASE);
+    __atomic_store_n(&engine->cfg.num_silk, first + num, __ATOMIC_RELEASE);
+    engine->num_free_silk += num;
+    engine->num_pool_grow++;
+    SILK_DEBUG("pool grew by %d silks to %d", num, engine->cfg.num_silk);
+    return SILK_STAT_OK;
+}
+
+/*
+ * release the top chunk of the silks added when the pool grew (SILK_CFG_FLAG_POOL_SHRINK)
+ * once they are all free & enough other silks are free, so a load hovering around the
+ * chunk boundary doesnt grow & shrink the pool over & over. it is called by the idle
+ * processing, so no msg in the queue targets them, but a msg sent meanwhile might (it is
+ * dropped by silk_yield()). when we run on one of them, a NOOP msg moves us to a free silk
+ * below the chunk & the chunk is released on the next pass.
+ */
+static void
+silk__pool_shrink (struct silk_engine_t   *engine,
+                   struct silk_t          *cur)
+{
+    struct silk_stack_class_t   *cls = engine->stack_class;
+    uint32_t   num = engine->cfg.num_silk - engine->num_boot_silk;
+    uint32_t   num_keep = engine->cfg.num_grow_silks / 2;
+    uintptr_t  start, end;
+    silk_id_t  first;
+    struct silk_t   *s, *prev, *next;
+    void       *addr;
+    uint32_t   seg;
+    int    i;
+
+    if (likely(num == 0)) {
+        return;
+    }
+    // the chunks are as large as the growth, but the last one might be partial
+    if (num > engine->cfg.num_grow_silks) {
+        num = engine->cfg.num_grow_silks;
+    }
+    if (num_keep > engine->num_boot_silk) {
+        num_keep = engine->num_boot_silk;
+    }
+    first = engine->cfg.num_silk - num;
+    // the lock keeps silk_alloc() from taking (or re-growing) the silks we release
+    pthread_mutex_lock(&engine->mtx);
+    if (engine->num_free_silk < num + num_keep) {
+        goto out;
+    }
+    for (i = first; i < engine->cfg.num_silk; i++) {
+        if (SILK_STATE(silk_get_ctrl_from_id(engine, i)) != SILK_STATE__FREE) {
+            goto out;
+        }
+    }
+    if (cur->silk_id >= first) {
+        SLIST_FOREACH(s, &cls->free_silks, next_free) {
+            if (s->silk_id < first) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&engine->mtx);
+        if (s != NULL) {
+            silk_send_msg_code(engine, SILK_MSG_NOOP, s->silk_id);
+        }
+        return;
+    }
+    for (prev = NULL, s = SLIST_FIRST(&cls->free_silks); s != NULL; s = next) {
+        next = SLIST_NEXT(s, next_free);
+        if (s->silk_id < first) {
+            prev = s;
+        } else if (prev == NULL) {
+            SLIST_REMOVE_HEAD(&cls->free_silks, next_free);
+        } else {
+            SLIST_NEXT(prev, next_free) = next;
+        }
+    }
+    for (i = first; i < engine->cfg.num_silk; i++) {
+        s = silk_get_ctrl_from_id(engine, i);
+        if (s->fpu != NULL) {
+            free(s->fpu->area_buf);
+            free(s->fpu);
+        }
+        free(s->stack_save_buf);
+        memset(s, 0, engine->silk_size);
+    }
+    // give the pages back. the stacks are reserved (PROT_NONE) until the pool grows again
+    for (i = first; i < engine->cfg.num_silk; i++) {
+        addr = silk__stack_seg_addr(engine, i);
+        if ((mprotect(addr, cls->stack_size, PROT_NONE) != 0) ||
+            (madvise(addr, cls->stack_size, MADV_DONTNEED) != 0)) {
+            SILK_WARN("Failed to release the stack of Silk#%d. errno=%d", i, errno);
+        }
+    }
+    // only the control block pages which hold no other silk
+    start = ((uintptr_t)silk__ctrl_addr(engine, first) + PAGE_SIZE - 1) & ~((uintptr_t)PAGE_SIZE - 1);
+    end = (uintptr_t)silk__ctrl_addr(engine, engine->cfg.num_silk) & ~((uintptr_t)PAGE_SIZE - 1);
+    if (end > start) {
+        madvise((void*)start, end - start, MADV_DONTNEED);
+    }
+    if (engine->arena_addr != NULL) {
+        madvise(silk_get_arena_from_id(engine, first), num * engine->arena_size, MADV_DONTNEED);
+    }
+    // and the segments which have no silk left
+    for (seg = (first - engine->num_boot_silk + SILK_STACK_SEG_SILKS - 1) / SILK_STACK_SEG_SILKS;
+         seg < engine->num_stack_segs;
+         seg++) {
+        if (engine->stack_seg[seg] != NULL) {
+            munmap(engine->stack_seg[seg], engine->stack_seg_size);
+            engine->stack_seg[seg] = NULL;
+            SILK_DEBUG("released stack segment %u", seg);
+        }
+    }
+    __atomic_store_n(&cls->num_silk, cls->num_silk - num, __ATOMIC_RELEASE);
+    __atomic_store_n(&engine->cfg.num_silk, first, __ATOMIC_RELEASE);
+    engine->num_free_silk -= num;
+    engine->num_pool_shrink++;
+    SILK_DEBUG("pool shrank by %d silks to %d", num, engine->cfg.num_silk);
+
+ out:
+    pthread_mutex_unlock(&engine->mtx);
+}
+
+/*
+ * fetch the next msg to process into "last_msg". a silk which overflowed its stack comes
+ * first: it gets a TERM msg (not through the queue), so it is recycled like a killed silk.
+ */
+static inline bool
+silk__next_msg (struct silk_engine_t             *engine,
+                struct silk_execution_thread_t   *exec_thr)
+{
+    if (unlikely(exec_thr->overflow_silk != NULL)) {
+        memset(&exec_thr->last_msg, 0, sizeof(exec_thr->last_msg));
+        exec_thr->last_msg.msg = SILK_MSG_TERM;
+        exec_thr->last_msg.silk_id = exec_thr->overflow_silk->silk_id;
+        exec_thr->overflow_silk = NULL;
+        return true;
+    }
+    return silk_sched_get_next(&engine->msg_sched, &exec_thr->last_msg);
+}
+
 /*
  * This API allows the scheduler to take the calling Silk out-of-execution & switch 
  * to another silk instance. the specifics of such a decision is scheduler-specific.
@@ -397,18 +1894,29 @@ void silk_yield(struct silk_msg_t   *msg)
     enum silk_status_e              ret;
 
 
+    // the silk is done with the msg it received before
+    silk__msg_payload_release(engine, s);
     do {
         /*
          * retrieve the next msg (based on priorities & any other application
          * specific rule) to be processed.
          */
-        if (silk_sched_get_next(&exec_thr->engine->msg_sched, &exec_thr->last_msg)) {
+        if (silk__next_msg(engine, exec_thr)) {
             {// debugging aid
                 struct silk_msg_t                     *m = &exec_thr->last_msg;
                 SILK_DEBUG("recv msg={code=%d, id=%d, ctx=%p}", m->msg, m->silk_id, m->ctx);
             }
             msg_silk_id = exec_thr->last_msg.silk_id;
-            silk_trgt = &engine->silks[msg_silk_id];
+            // a msg sent to a silk which was released when the pool shrank
+            if (unlikely(msg_silk_id >= silk_get_num_silk(engine))) {
+                SILK_DEBUG("dropping a msg bcz Silk#%d was released", msg_silk_id);
+                if (unlikely(exec_thr->last_msg.flags & SILK_MSG_FLAG__PAYLOAD)) {
+                    silk_payload_free(engine, exec_thr->last_msg.ctx);
+                }
+                engine->num_stale_msg++;
+                continue;
+            }
+            silk_trgt = silk_get_ctrl_from_id(engine, msg_silk_id);
             assert(silk_trgt->silk_id == msg_silk_id);
             /*
              * check if we got a msg instructing us to kill the silk instance. if so, no
@@ -421,16 +1929,7 @@ void silk_yield(struct silk_msg_t   *msg)
                     continue;
                 }
                 SILK_DEBUG("recycling a terminated Silk#%d", silk_trgt->silk_id);
-                silk__set_state(silk_trgt, SILK_STATE__BOOT);
-                SLIST_INSERT_HEAD(&engine->free_silks, silk_trgt, next_free);
-                // initialize stack context bcz the silk should start from a clean stack.
-                silk_create_initial_stack_context(&silk_trgt->exec_state,
-                                                  silk__main,
-                                                  silk_get_stack_from_id(engine, msg_silk_id),
-                                                  SILK_USEABLE_STACK(&engine->cfg));
-                // let the re-initialized silk to run till it awaits the START msg
-                ret = silk_send_msg_code(engine, SILK_MSG_BOOT, silk_trgt->silk_id);
-                assert(ret == SILK_STAT_OK);
+                silk__recycle(engine, exec_thr, silk_trgt);
                 /*
                  * we've just sent BOOT msgs to the silk & now we need it to start running
                  * from the entry function. 
@@ -448,7 +1947,20 @@ void silk_yield(struct silk_msg_t   *msg)
                  */
                 if (s->silk_id == msg_silk_id) {
                     // we recycle the silk on which we are currently running.
-                    SILK_SWITCH(silk_trgt->exec_state, s->exec_state);
+                    if (unlikely(engine->num_run_stacks > 0)) {
+                        /*
+                         * the boot frame must be loaded onto the run stack we run on, so
+                         * the switcher does it. our context is never resumed.
+                         */
+                        struct silk_exec_state_t   dead_state;
+
+                        silk__set_cur_silk(silk_trgt);
+                        exec_thr->switch_to = silk_trgt;
+                        SILK_SWITCH(exec_thr->switcher_state, dead_state);
+                    } else {
+                        silk__set_cur_silk(silk_trgt);
+                        SILK_SWITCH(silk_trgt->exec_state, s->exec_state);
+                    }
                     assert(0); // we should NOT return from the switch.
                 } else {
                     /*
@@ -468,6 +1980,9 @@ void silk_yield(struct silk_msg_t   *msg)
              */
             if (unlikely(SILK_STATE(silk_trgt) == SILK_STATE__TERM)) {
                 SILK_DEBUG("dropping a msg bcz silk is killed, pending recycle");
+                if (unlikely(exec_thr->last_msg.flags & SILK_MSG_FLAG__PAYLOAD)) {
+                    silk_payload_free(engine, exec_thr->last_msg.ctx);
+                }
                 continue;
             }
 
@@ -485,13 +2000,28 @@ void silk_yield(struct silk_msg_t   *msg)
             if (likely(s->silk_id != msg_silk_id)) {
                 SILK_DEBUG("switching from Silk#%d to Silk#%d",
                            s->silk_id, silk_trgt->silk_id);
-                SILK_SWITCH(silk_trgt->exec_state, s->exec_state);
+                if (unlikely(s->state & SILK_ALLOC_FLAG__FPU_MASK)) {
+                    silk__fpu_save(exec_thr, s);
+                }
+                silk__switch(engine, exec_thr, s, silk_trgt);
+                if (unlikely(s->state & SILK_ALLOC_FLAG__FPU_MASK)) {
+                    silk__fpu_restore(exec_thr, s);
+                }
                 SILK_DEBUG("switched into Silk#%d", s->silk_id);
             }
             memcpy(msg, &exec_thr->last_msg, sizeof(*msg));
+            if (unlikely(msg->flags & SILK_MSG_FLAG__PAYLOAD)) {
+                s->msg_payload = msg->ctx;
+            }
             is_msg_avail = true;
         } else { 
             // IDLE processing
+            if (unlikely(engine->cfg.flags & SILK_CFG_FLAG_HIBERNATE)) {
+                silk__hibernate_scan(engine, s);
+            }
+            if (unlikely(engine->cfg.flags & SILK_CFG_FLAG_POOL_SHRINK)) {
+                silk__pool_shrink(engine, s);
+            }
             engine->cfg.idle_cb(exec_thr);
         }
     } while (!is_msg_avail);
@@ -510,6 +2040,173 @@ __attribute__((noreturn)) void silk_drain_msgs()
     } while (1);
 }
 
+/*
+ * the SIGSEGV action in place before the stack overflow handler was installed & the
+ * number of engines which use the handler (SILK_CFG_FLAG_STACK_GUARD).
+ */
+static pthread_mutex_t    silk__guard_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct sigaction   silk__guard_old_action;
+static uint32_t           silk__guard_num_engines;
+
+/*
+ * return the silk which overflowed its stack, if a fault at "addr" (when the stack pointer
+ * was "sp") is on the guard below a stack & the stack pointer is on the same stack. The
+ * guard of a stack is the separator pages below it so every class starts with a guard.
+ */
+static struct silk_t *
+silk__guard_find_silk (struct silk_engine_t             *engine,
+                       struct silk_execution_thread_t   *exec_thr,
+                       uintptr_t                        addr,
+                       uintptr_t                        sp)
+{
+    const size_t    guard_size = engine->cfg.num_stack_seperator_pages * PAGE_SIZE;
+    const struct silk_stack_class_t   *cls;
+    uintptr_t   base, stack_base;
+    uint32_t    num_stacks, idx, seg;
+    silk_id_t   silk_id;
+
+    for (cls = engine->stack_class; cls < engine->stack_class + engine->num_stack_classes; cls++) {
+        num_stacks = (engine->num_run_stacks > 0) ? engine->num_run_stacks : cls->num_silk;
+        // the silks added when the pool grew are in the stack segments
+        if (cls->first_silk_id + num_stacks > engine->num_boot_silk) {
+            num_stacks = engine->num_boot_silk - cls->first_silk_id;
+        }
+        base = (uintptr_t)cls->stack_addr - guard_size;
+        if ((addr < base) || (addr >= base + num_stacks * cls->padded_stack_size)) {
+            continue;
+        }
+        idx = (addr - base) / cls->padded_stack_size;
+        stack_base = base + idx * cls->padded_stack_size;
+        if ((addr - stack_base >= guard_size) ||
+            (sp < stack_base) || (sp >= stack_base + cls->padded_stack_size)) {
+            return NULL;
+        }
+        if (engine->num_run_stacks > 0) {
+            // the running silk, unless the fault is on another run stack
+            return (silk__my_cur_silk()->silk_id % engine->num_run_stacks == idx) ?
+                silk__my_cur_silk() : NULL;
+        }
+        return silk_get_ctrl_from_id(engine, cls->first_silk_id + idx);
+    }
+    // the segment of the fault, if it is one of ours
+    base = addr & ~(engine->stack_seg_size - 1);
+    for (seg = 0; seg < engine->num_stack_segs; seg++) {
+        if ((uintptr_t)engine->stack_seg[seg] != base) {
+            continue;
+        }
+        cls = engine->stack_class;
+        base += SILK_STACK_SEG_OFFSET(engine) - guard_size;
+        if (addr < base) {
+            // the header page
+            return NULL;
+        }
+        idx = (addr - base) / cls->padded_stack_size;
+        stack_base = base + idx * cls->padded_stack_size;
+        silk_id = engine->num_boot_silk + seg * SILK_STACK_SEG_SILKS + idx;
+        if ((idx >= SILK_STACK_SEG_SILKS) || (silk_id >= silk_get_num_silk(engine)) ||
+            (addr - stack_base >= guard_size) ||
+            (sp < stack_base) || (sp >= stack_base + cls->padded_stack_size)) {
+            return NULL;
+        }
+        return silk_get_ctrl_from_id(engine, silk_id);
+    }
+    return NULL;
+}
+
+/*
+ * The SIGSEGV handler. it runs on the alternate signal stack of the engine thread, so
+ * the stack of a silk that overflowed can be rebuilt. the silk might have held a lock
+ * (or been inside stdio) when it overflowed, so we only mark it & restart it on a clean
+ * stack. once out of the handler, it has the engine thread recycle it through the TERM
+ * path (see silk__main()). The context of the handler is never resumed.
+ * Note: SA_NODEFER keeps SIGSEGV unblocked after we switch out of the handler.
+ * BEWARE: a lock the silk held when it overflowed is never released.
+ */
+static void
+silk__guard_handler (int         sig,
+                     siginfo_t   *info,
+                     void        *_uctx)
+{
+    struct silk_execution_thread_t   *exec_thr = silk__my_thread_obj();
+    const ucontext_t                 *uctx = _uctx;
+    struct silk_engine_t             *engine;
+    struct silk_exec_state_t          dead_state;
+    struct silk_t                    *s = NULL;
+    uintptr_t    sp;
+
+#if defined (__i386__)
+    sp = uctx->uc_mcontext.gregs[REG_ESP];
+#elif defined (__x86_64__)
+    sp = uctx->uc_mcontext.gregs[REG_RSP];
+#endif
+    if ((exec_thr != NULL) && (exec_thr->engine->cfg.flags & SILK_CFG_FLAG_STACK_GUARD)) {
+        s = silk__guard_find_silk(exec_thr->engine, exec_thr, (uintptr_t)info->si_addr, sp);
+    }
+    if (s == NULL) {
+        // not a stack overflow. pass it on to the previous handler (or the default action)
+        if ((silk__guard_old_action.sa_flags & SA_SIGINFO) &&
+            (silk__guard_old_action.sa_sigaction != NULL)) {
+            silk__guard_old_action.sa_sigaction(sig, info, _uctx);
+        } else {
+            // the fault happens again when we return
+            sigaction(SIGSEGV, &silk__guard_old_action, NULL);
+        }
+        return;
+    }
+    engine = exec_thr->engine;
+    engine->num_stack_overflow++;
+    exec_thr->overflow_silk = s;
+    silk__init_context(engine, s);
+    if (engine->num_run_stacks > 0) {
+        // we arent on the run stack so we can load the boot frame ourselves
+        silk__stack_load(engine, s);
+    }
+    silk__set_cur_silk(s);
+    SILK_SWITCH(s->exec_state, dead_state);
+    assert(0); // we should NOT return from the switch.
+}
+
+/*
+ * install the stack overflow handler, unless another engine already did.
+ */
+static enum silk_status_e
+silk__guard_install (void)
+{
+    struct sigaction     act;
+    enum silk_status_e   ret = SILK_STAT_OK;
+
+    pthread_mutex_lock(&silk__guard_mtx);
+    if (silk__guard_num_engines == 0) {
+        memset(&act, 0, sizeof(act));
+        act.sa_sigaction = silk__guard_handler;
+        act.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+        sigemptyset(&act.sa_mask);
+        if (sigaction(SIGSEGV, &act, &silk__guard_old_action) != 0) {
+            SILK_ERROR("Failed to install the stack overflow handler. errno=%d", errno);
+            ret = SILK_STAT_INVALID_STACK_GUARD;
+            goto out;
+        }
+    }
+    silk__guard_num_engines++;
+ out:
+    pthread_mutex_unlock(&silk__guard_mtx);
+    return ret;
+}
+
+/*
+ * restore the previous SIGSEGV action once no engine uses the stack overflow handler.
+ */
+static void
+silk__guard_uninstall (void)
+{
+    pthread_mutex_lock(&silk__guard_mtx);
+    assert(silk__guard_num_engines > 0);
+    if (--silk__guard_num_engines == 0) {
+        sigaction(SIGSEGV, &silk__guard_old_action, NULL);
+    }
+    pthread_mutex_unlock(&silk__guard_mtx);
+}
+
 /*
  * notifies the engine to terminate itself (i.e.: stop processing & be ready for
  * cleanup).
@@ -532,17 +2229,45 @@ enum silk_status_e
 silk_join(struct silk_engine_t   *engine)
 {
     struct silk_engine_param_t   *cfg = &engine->cfg;
-    size_t              stack_size;
+    struct silk_t       *s;
     enum silk_status_e  ret;
-    int     rc;
+    int     rc, i;
 
 
     ret = silk_eng_join(&engine->exec_thr);
     if (ret != SILK_STAT_OK)
         return ret;
-    free(engine->silks);
-    stack_size = SILK_PADDED_STACK(cfg) * cfg->num_silk;
-    rc = munmap(engine->stack_addr, stack_size);
+    for (i = 0; i < cfg->num_silk; i++) {
+        s = silk_get_ctrl_from_id(engine, i);
+        if (s->fpu != NULL) {
+            free(s->fpu->area_buf);
+            free(s->fpu);
+        }
+        free(s->stack_save_buf);
+    }
+    silk__free_silks(engine);
+    if (engine->arena_addr != NULL) {
+        munmap(engine->arena_addr, engine->cfg.max_silk * engine->arena_size);
+    }
+    if (engine->payload_addr != NULL) {
+        munmap(engine->payload_addr, engine->cfg.num_payloads * engine->payload_padded_size);
+    }
+    for (i = 0; i < SILK_PAYLOAD_NUM_CACHES; i++) {
+        pthread_mutex_destroy(&engine->payload_cache[i].mtx);
+    }
+    silk_sched_terminate(&engine->msg_sched);
+    free(engine->run_stack);
+    for (i = 0; i < engine->num_stack_segs; i++) {
+        if (engine->stack_seg[i] != NULL) {
+            munmap(engine->stack_seg[i], engine->stack_seg_size);
+        }
+    }
+    free(engine->stack_seg);
+    if (engine->exec_thr.alt_stack != NULL) {
+        silk__guard_uninstall();
+        munmap(engine->exec_thr.alt_stack, SILK_GUARD_ALT_STACK_SIZE);
+    }
+    rc = munmap(engine->stack_addr, engine->stack_area_size);
     if (rc != 0) {
         SILK_ERROR("Failed to unmap stack area memory. errno=%d", errno);
         ret = SILK_STAT_STACK_FREE_FAILED;
@@ -550,6 +2275,36 @@ silk_join(struct silk_engine_t   *engine)
     return ret;
 }
 
+/*
+ * make sure a silk has the buffers to preserve the FPU state as requested by the
+ * allocation flags. The buffers are kept for the next allocations of the silk.
+ */
+static enum silk_status_e
+silk__fpu_alloc(struct silk_engine_t   *engine,
+                struct silk_t          *s,
+                uint32_t               flags)
+{
+    void    *buf;
+
+    if (s->fpu == NULL) {
+        s->fpu = calloc(1, sizeof(*s->fpu));
+        if (s->fpu == NULL) {
+            return SILK_STAT_ALLOC_FAIL;
+        }
+    }
+    if ((flags & SILK_ALLOC_FLAG__FPU_FULL) && (s->fpu->area == NULL)) {
+        // the xsave area must be 64 byte aligned
+        buf = calloc(1, engine->fpu_area_size + 63);
+        if (buf == NULL) {
+            return SILK_STAT_ALLOC_FAIL;
+        }
+        s->fpu->area_buf = buf;
+        s->fpu->area = (void*)(((uintptr_t)buf + 63) & ~(uintptr_t)63);
+    }
+    s->fpu->is_saved = false;
+    return SILK_STAT_OK;
+}
+
 /*
  * allocate a silk instance to schedule new work
  *
@@ -557,6 +2312,8 @@ silk_join(struct silk_engine_t   *engine)
  * engine - the engine from which the silk is allocated & to which it is posted for execution.
  * entry_func - the function that will be executed by the silk instance.
  * ctx - a value that will be passed on to the entry_func (just like in pthread_create())
+ * flags - SILK_ALLOC_FLAG__* requesting extra services for the silk (e.g.: preserving
+ *         its FPU state) & the smallest stack class it may get. 
  *
  * Ouput
  * silk - the silk instance that was allocated.
@@ -565,17 +2322,46 @@ enum silk_status_e
 silk_alloc(struct silk_engine_t   *engine,
            silk_uthread_func_t    entry_func,
            void                   *entry_func_arg,
+           uint32_t               flags,
            struct silk_t        **silk)
 {
+    struct silk_stack_class_t   *cls;
     struct silk_t  *s;
     enum silk_status_e   silk_stat;
+    uint32_t   class_id = (flags & SILK_ALLOC_FLAG__STACK_CLASS_MASK) >> SILK_ALLOC_FLAG__STACK_CLASS_SHIFT;
 
 
+    assert((flags & ~(SILK_ALLOC_FLAG__MASK | SILK_ALLOC_FLAG__STACK_CLASS_MASK)) == 0);
+    if (unlikely(class_id >= engine->num_stack_classes)) {
+        return SILK_STAT_INVALID_STACK_CLASS;
+    }
+    flags &= SILK_ALLOC_FLAG__MASK;
     pthread_mutex_lock(&engine->mtx);
+    // find the smallest class which has a free silk. the classes are ordered by stack size.
+    for (cls = &engine->stack_class[class_id];
+         (cls < engine->stack_class + engine->num_stack_classes) && SLIST_EMPTY(&cls->free_silks);
+         cls++);
+    // grow the pool (of a single class) if it may
+    if (unlikely(cls == engine->stack_class + engine->num_stack_classes) &&
+        (engine->cfg.num_silk < engine->cfg.max_silk)) {
+        silk_stat = silk__pool_grow(engine);
+        if (silk_stat != SILK_STAT_OK) {
+            goto out;
+        }
+        cls = engine->stack_class;
+    }
     // take a silk instance off the free list (if possible)
-    if (likely(!SLIST_EMPTY(&engine->free_silks))) {
-        s = SLIST_FIRST(&engine->free_silks);
-        SLIST_REMOVE_HEAD(&engine->free_silks, next_free);
+    if (likely(cls < engine->stack_class + engine->num_stack_classes)) {
+        s = SLIST_FIRST(&cls->free_silks);
+        if (unlikely(flags & SILK_ALLOC_FLAG__FPU_MASK)) {
+            silk_stat = silk__fpu_alloc(engine, s, flags);
+            if (silk_stat != SILK_STAT_OK) {
+                goto out;
+            }
+        }
+        SLIST_REMOVE_HEAD(&cls->free_silks, next_free);
+        // it is about to run & touch its stack again
+        s->stack_released = false;
         engine->num_free_silk--;
         assert(engine->num_free_silk >= 0);
         SILK_DEBUG("allocated Silk#%d. still %d available",
@@ -584,6 +2370,7 @@ silk_alloc(struct silk_engine_t   *engine,
         // initialize new silk startup info
         s->entry_func = entry_func;
         s->entry_func_arg = entry_func_arg;
+        s->state = (s->state & ~SILK_ALLOC_FLAG__MASK) | flags;
         silk__set_state(s, SILK_STATE__ALLOC);
         *silk = s;
 
@@ -592,6 +2379,7 @@ silk_alloc(struct silk_engine_t   *engine,
         silk_stat = SILK_STAT_NO_FREE_SILK;
     }
 
+ out:
     pthread_mutex_unlock(&engine->mtx);
     return silk_stat;
 }
@@ -613,6 +2401,21 @@ silk_dispatch(struct silk_engine_t   *engine,
 }
 
 
+enum silk_status_e
+silk_stack_profile_get(struct silk_engine_t          *engine,
+                       struct silk_stack_profile_t   *profiles,
+                       uint32_t                      *num_profiles)
+{
+    pthread_mutex_lock(&engine->mtx);
+    if (*num_profiles > engine->num_stack_profile) {
+        *num_profiles = engine->num_stack_profile;
+    }
+    memcpy(profiles, engine->stack_profile, *num_profiles * sizeof(*profiles));
+    pthread_mutex_unlock(&engine->mtx);
+    return SILK_STAT_OK;
+}
+
+
 /*
  * a set of silk_kill_*() API's which will cause the silk instance to stop running & become
  * free for new allocation.
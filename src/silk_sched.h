@@ -14,14 +14,46 @@
  *    based on various parameters rather than by the msg priority).
  */
 
+#include <stdlib.h>
+
 /*
  * common info of all schedulers.
  */
 struct silk_sched_base_t {
-    void *dummy;// TODO: consider removing this structure if no use
+    // the memory allocated by the scheduler (see silk_sched_alloc())
+    void    *buf;
 };
 
+/*
+ * allocate the memory of a scheduler (e.g.: its msgs), aligned to a cache line. it is
+ * freed by silk_sched_free().
+ */
+static inline void *
+silk_sched_alloc(struct silk_sched_base_t   *base,
+                 size_t                     len)
+{
+    base->buf = malloc(len + SILK_CACHE_LINE_SIZE - 1);
+    if (base->buf == NULL) {
+        return NULL;
+    }
+    return (void*)(((uintptr_t)base->buf + SILK_CACHE_LINE_SIZE - 1) &
+                   ~((uintptr_t)SILK_CACHE_LINE_SIZE - 1));
+}
+
+static inline void
+silk_sched_free(struct silk_sched_base_t   *base)
+{
+    free(base->buf);
+    base->buf = NULL;
+}
+
 
+#if defined (SILK_SCHED__MPSC)
+#include "silk_sched_mpsc.h"
+#elif defined (SILK_SCHED__VANILLA)
 #include "silk_sched_vanilla.h"
+#else
+#error "no msg scheduler selected (see config.h)"
+#endif
 
 #endif // __SILK_SCHED_H__
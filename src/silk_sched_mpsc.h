@@ -0,0 +1,195 @@
+/*
+ * Copyight (C) Eitan Ben-Amos, 2012
+ */
+#ifndef __SILK_SCHED_MPSC_H__
+#define __SILK_SCHED_MPSC_H__
+
+#include <memory.h>
+
+/*
+ * A lock-free scheduler, with the same API as the vanilla one. it is:
+ * 1) fixed size for msg instance & the whole msg queue (a power of 2 set on init, so the
+ *    ring wraps with a mask).
+ * 2) the producers claim a slot by a CAS on "next_write" & publish the msg in it by setting
+ *    the sequence number of the slot (release semantics). the single consumer (the engine
+ *    thread) pops a slot once its sequence number shows it was published & hands it back
+ *    to the producers by advancing its sequence number by a lap of the ring.
+ *    a producer finds the queue full by the sequence number of the slot it would claim,
+ *    so the producers dont read the consumer index (& its cache line) on every send.
+ * 3) queue is processed with strict order of FIFO (the order the slots were claimed in)
+ * 4) when terminated, will process the whole queue until it pops the SILK_MSG_TERM_THREAD msg
+ *
+ * Notes:
+ * the indexes are free running (they wrap at 2^32, which is a multiple of the ring size)
+ * & the "_" APIs are identical to the others, there is no lock.
+ * a producer which claimed a slot but didnt publish it yet holds back the consumer (not
+ * the other producers) until it does.
+ */
+
+struct silk_incoming_msg_queue_t {
+    // common info of all schedulers.
+    struct silk_sched_base_t     base;
+    /*
+     * the msgs (a power of 2 of them, allocated on init) & the mask of an index into them.
+     * the sequence number of each slot is "index" when it is free for the producer claiming
+     * "index" & "index + 1" once that msg is published.
+     */
+    struct silk_msg_t            *msgs;
+    uint32_t                     *seq;
+    uint32_t                     mask;
+    // the producers side: the next slot to claim. a cache line of its own
+    uint32_t                     next_write SILK_CACHE_ALIGNED;
+    // the consumer side: the next slot to pop, written by the engine thread only
+    uint32_t                     next_read SILK_CACHE_ALIGNED;
+};
+
+
+/*
+ * initialize a msg scheduler with room for "size" msgs (a power of 2)
+ */
+static inline enum silk_status_e
+silk_sched_init(struct silk_incoming_msg_queue_t      *q,
+                uint32_t                              size)
+{
+    uint32_t   i;
+
+    assert((size > 0) && ((size & (size - 1)) == 0));
+    // the sequence numbers follow the msgs
+    q->msgs = silk_sched_alloc(&q->base, size * (sizeof(*q->msgs) + sizeof(*q->seq)));
+    if (q->msgs == NULL) {
+        return SILK_STAT_ALLOC_FAIL;
+    }
+    q->seq = (uint32_t *)(q->msgs + size);
+    memset(q->msgs, 0, size * sizeof(*q->msgs));
+    for (i = 0; i < size; i++) {
+        q->seq[i] = i;
+    }
+    q->mask = size - 1;
+    q->next_write = 0;
+    q->next_read = 0;
+    return SILK_STAT_OK;
+}
+
+/*
+ * terminate a msg scheduler
+ */
+static inline enum silk_status_e
+silk_sched_terminate(struct silk_incoming_msg_queue_t      *q)
+{
+    silk_sched_free(&q->base);
+    q->seq = NULL;
+    q->msgs = NULL;
+    return SILK_STAT_OK;
+}
+
+/*
+ * the slot of a free running index
+ */
+static inline uint32_t
+silk_sched_slot(struct silk_incoming_msg_queue_t      *q,
+                uint32_t                              index)
+{
+    return index & q->mask;
+}
+
+static inline bool
+_silk_sched_is_empty(struct silk_incoming_msg_queue_t      *q)
+{
+    if (__atomic_load_n(&q->next_write, __ATOMIC_ACQUIRE) ==
+        __atomic_load_n(&q->next_read, __ATOMIC_ACQUIRE)) {
+        return true;
+    } else {
+        return false;
+    }
+}
+
+static inline bool
+silk_sched_is_empty(struct silk_incoming_msg_queue_t      *q)
+{
+    return _silk_sched_is_empty(q);
+}
+
+static inline bool
+_silk_sched_is_full(struct silk_incoming_msg_queue_t      *q)
+{
+    if (__atomic_load_n(&q->next_write, __ATOMIC_ACQUIRE) -
+        __atomic_load_n(&q->next_read, __ATOMIC_ACQUIRE) > q->mask) {
+        return true;
+    } else {
+        return false;
+    }
+}
+
+static inline bool
+silk_sched_is_full(struct silk_incoming_msg_queue_t      *q)
+{
+    return _silk_sched_is_full(q);
+}
+
+static inline uint32_t
+_silk_sched_get_q_size(struct silk_incoming_msg_queue_t      *q)
+{
+    return __atomic_load_n(&q->next_write, __ATOMIC_ACQUIRE) -
+        __atomic_load_n(&q->next_read, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * if queue isnt full, write the msg into the tail of the queue
+ * internal Silk library API, for engine layer only
+ */
+static inline enum silk_status_e
+silk_sched_send(struct silk_incoming_msg_queue_t      *q,
+                struct silk_msg_t                     *msg)
+{
+    uint32_t   index = __atomic_load_n(&q->next_write, __ATOMIC_RELAXED);
+    uint32_t   seq;
+    int32_t    diff;
+
+    do {
+        seq = __atomic_load_n(&q->seq[silk_sched_slot(q, index)], __ATOMIC_ACQUIRE);
+        diff = (int32_t)(seq - index);
+        if (diff < 0) {
+            // the consumer didnt pop the msg of the previous lap yet
+            return SILK_STAT_Q_FULL;
+        }
+        if (diff > 0) {
+            // another producer claimed it
+            index = __atomic_load_n(&q->next_write, __ATOMIC_RELAXED);
+            continue;
+        }
+        // on failure, "index" is reloaded
+    } while ((diff != 0) ||
+             !__atomic_compare_exchange_n(&q->next_write, &index, index + 1, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    q->msgs[silk_sched_slot(q, index)] = *msg;
+    // publish the msg to the consumer
+    __atomic_store_n(&q->seq[silk_sched_slot(q, index)], index + 1, __ATOMIC_RELEASE);
+    return SILK_STAT_OK;
+}
+
+/*
+ * fetch the next msg to be processed, based on the scheduler scheduling decision
+ * This is the place to implement various scheduling policies such as priority
+ * queue, etc
+ * return true when a msg is returned, false otherwise
+ * BEWARE: called by the engine thread only (the single consumer)
+ */
+static inline bool
+silk_sched_get_next(struct silk_incoming_msg_queue_t      *q,
+                    struct silk_msg_t                     *msg)
+{
+    const uint32_t   next_read = q->next_read;
+    const uint32_t   slot = silk_sched_slot(q, next_read);
+
+    if (__atomic_load_n(&q->seq[slot], __ATOMIC_ACQUIRE) != next_read + 1) {
+        return false;
+    }
+    *msg = q->msgs[slot];
+    // only now the producers of the next lap may reuse the slot
+    __atomic_store_n(&q->seq[slot], next_read + q->mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&q->next_read, next_read + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+#endif // __SILK_SCHED_MPSC_H__
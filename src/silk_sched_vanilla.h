@@ -8,14 +8,19 @@
 
 /*
  * The first scheduler is a very basic one with which we develop the core library. it is:
- * 1) fixed size for msg instance & the whole msg queue.
- * 2) queue access requires a mutex lock
+ * 1) fixed size for msg instance & the whole msg queue (a power of 2 set on init, so the
+ *    ring wraps with a mask).
+ * 2) the producers serialize on a mutex lock. the single consumer (the engine thread)
+ *    doesnt lock: it reads "next_write" with acquire semantics & publishes "next_read"
+ *    with release semantics, so a slot is reused only after the consumer copied it out.
  * 3) queue is processed with strict order of FIFO
  * 4) when terminated, will process the whole queue until it pops the SILK_MSG_TERM_THREAD msg
  *
  * Notes:
  * Some API's have both a locked & unlocked version. the unlocked has a 
  * preceding "_" but is otherwise identical
+ * the indexes are free running (they wrap at 2^32, which is a multiple of the ring size),
+ * so the queue holds "size" msgs, just like the MPSC one.
  *
  * 
  * TODO: the whole scheduler is here !!!
@@ -25,23 +30,37 @@
 struct silk_incoming_msg_queue_t {
     // common info of all schedulers.
     struct silk_sched_base_t     base;
-    // a mutex to guard any access to the queue
-    pthread_mutex_t              mtx;
-    // a fixed number of msgs in a simple msg queue.
-#define MSG_QUEUE_SIZE           8*1024 // msgs
-    struct silk_msg_t            msgs[MSG_QUEUE_SIZE];
-    // The read/write indices into the msg vector
+    // the msgs (a power of 2 of them, allocated on init) & the mask of an index into them
+    struct silk_msg_t            *msgs;
+    uint32_t                     mask;
+    /*
+     * the producers side: a mutex to serialize the producers & the write index. it is on
+     * a cache line of its own, so the engine thread polling an empty queue (& popping msgs)
+     * doesnt steal it from the producers.
+     */
+    pthread_mutex_t              mtx SILK_CACHE_ALIGNED;
     uint32_t                     next_write;
-    uint32_t                     next_read;
+    // the consumer side: the read index, written by the engine thread only
+    uint32_t                     next_read SILK_CACHE_ALIGNED;
 };
 
 
+/*
+ * initialize a msg scheduler with room for "size" msgs (a power of 2)
+ */
 static inline enum silk_status_e
-silk_sched_init(struct silk_incoming_msg_queue_t      *q)
+silk_sched_init(struct silk_incoming_msg_queue_t      *q,
+                uint32_t                              size)
 {
+    assert((size > 0) && ((size & (size - 1)) == 0));
+    q->msgs = silk_sched_alloc(&q->base, size * sizeof(*q->msgs));
+    if (q->msgs == NULL) {
+        return SILK_STAT_ALLOC_FAIL;
+    }
+    memset(q->msgs, 0, size * sizeof(*q->msgs));
+    q->mask = size - 1;
     q->next_write = 0;
     q->next_read = 0;
-    memset(q->msgs, 0, sizeof(q->msgs));
     pthread_mutex_init(&q->mtx, NULL);
     return SILK_STAT_OK;
 }
@@ -53,30 +72,29 @@ static inline enum silk_status_e
 silk_sched_terminate(struct silk_incoming_msg_queue_t      *q)
 {
     pthread_mutex_destroy(&q->mtx);
+    silk_sched_free(&q->base);
+    q->msgs = NULL;
     return SILK_STAT_OK;
 }
 
 /*
- * move the index into the next slot
- * BEWARE: queue must be locked
+ * the slot of a free running index
  */
 static inline uint32_t
-silk_sched_next_index(uint32_t       index)
+silk_sched_slot(struct silk_incoming_msg_queue_t      *q,
+                uint32_t                              index)
 {
-    assert(index < MSG_QUEUE_SIZE);
-    index ++;
-    if (index == MSG_QUEUE_SIZE)
-        index = 0;
-    return index;
+    return index & q->mask;
 }
 
 /*
- * BEWARE: queue must be locked
+ * BEWARE: queue must be locked (unless called by the consumer)
  */
 static inline bool
 _silk_sched_is_empty(struct silk_incoming_msg_queue_t      *q)
 {
-    if (q->next_write == q->next_read) {
+    if (__atomic_load_n(&q->next_write, __ATOMIC_ACQUIRE) ==
+        __atomic_load_n(&q->next_read, __ATOMIC_ACQUIRE)) {
         return true;
     } else {
         return false;
@@ -99,7 +117,7 @@ silk_sched_is_empty(struct silk_incoming_msg_queue_t      *q)
 static inline bool
 _silk_sched_is_full(struct silk_incoming_msg_queue_t      *q)
 {
-    if (silk_sched_next_index(q->next_write) == q->next_read) {
+    if (q->next_write - __atomic_load_n(&q->next_read, __ATOMIC_ACQUIRE) > q->mask) {
         return true;
     } else {
         return false;
@@ -120,15 +138,8 @@ silk_sched_is_full(struct silk_incoming_msg_queue_t      *q)
 static inline uint32_t
 _silk_sched_get_q_size(struct silk_incoming_msg_queue_t      *q)
 {
-    const uintptr_t   wr = (uintptr_t)(q->next_write);
-    const uintptr_t   rd = (uintptr_t)(q->next_read);
-    const uintptr_t   start = (uintptr_t)(q->msgs);
-    uint32_t   size;
-
-
-    // beware of optimizing this to cause dangerous wraparounds
-    size = (wr - start) - (rd-start);
-    return size;
+    return __atomic_load_n(&q->next_write, __ATOMIC_ACQUIRE) -
+        __atomic_load_n(&q->next_read, __ATOMIC_ACQUIRE);
 }
 
 /*
@@ -146,8 +157,9 @@ silk_sched_send(struct silk_incoming_msg_queue_t      *q,
         silk_stat = SILK_STAT_Q_FULL;
         goto out;
     }
-    q->msgs[q->next_write] = *msg;
-    q->next_write = silk_sched_next_index(q->next_write);
+    q->msgs[silk_sched_slot(q, q->next_write)] = *msg;
+    // publish the msg to the consumer
+    __atomic_store_n(&q->next_write, q->next_write + 1, __ATOMIC_RELEASE);
     silk_stat = SILK_STAT_OK;
 
  out:
@@ -160,25 +172,21 @@ silk_sched_send(struct silk_incoming_msg_queue_t      *q,
  * This is the place to implement various scheduling policies such as priority
  * queue, etc
  * return true when a msg is returned, false otherwise
+ * BEWARE: called by the engine thread only (the single consumer), without locking
  */
 static inline bool
 silk_sched_get_next(struct silk_incoming_msg_queue_t      *q,
                     struct silk_msg_t                     *msg)
 {
-    bool ret;
+    const uint32_t   next_read = q->next_read;
 
-    pthread_mutex_lock(&q->mtx);
-    if (_silk_sched_is_empty(q)) {
-        ret = false;
-        goto out;
+    if (next_read == __atomic_load_n(&q->next_write, __ATOMIC_ACQUIRE)) {
+        return false;
     }
-    *msg = q->msgs[q->next_read];    
-    q->next_read = silk_sched_next_index(q->next_read);
-    ret = true;
-
- out:
-    pthread_mutex_unlock(&q->mtx);
-    return ret;
+    *msg = q->msgs[silk_sched_slot(q, next_read)];
+    // only now the producers may reuse the slot
+    __atomic_store_n(&q->next_read, next_read + 1, __ATOMIC_RELEASE);
+    return true;
 }
 
 
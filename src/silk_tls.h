@@ -19,6 +19,11 @@ enum silk_tls_id_e {
      * allows each pthread to retreive its own thread object which executes the silk instances.
      */
     SILK_TLS__THREAD_OBJ,
+    /*
+     * the silk running on the pthread (when it executes silks). it is set before every
+     * switch into a silk, so the calling silk is found without using its stack address.
+     */
+    SILK_TLS__CUR_SILK,
     // The last index, which also indicates the length of the required array
     SILK_TLS__MAX,
 };
@@ -72,4 +77,22 @@ silk__my_thread_obj ()
     return silk__get_tls(SILK_TLS__THREAD_OBJ);
 }
 
+/*
+ * retrive the silk running on the calling pthread (NULL if it doesnt execute silks)
+ */
+static inline struct silk_t *
+silk__my_cur_silk ()
+{
+    return silk__get_tls(SILK_TLS__CUR_SILK);
+}
+
+/*
+ * set the silk about to run on the calling pthread. called right before switching into it.
+ */
+static inline void
+silk__set_cur_silk (struct silk_t   *s)
+{
+    silk__set_tls(SILK_TLS__CUR_SILK, s);
+}
+
 #endif // __SILK_TLS_H__
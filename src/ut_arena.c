@@ -0,0 +1,196 @@
+/*
+ * Copyight (C) Eitan Ben-Amos, 2012
+ *
+ * a unit test program to test the scratch memory arena of the silks (silk_arena_alloc()) &
+ * their silk-local storage (silk_local()).
+ *
+ * Execution path
+ * we dispatch a few silks, each allocating from its arena & filling the memory with its
+ * silk ID. The main thread then sends all of them a msg per round so they are interleaved
+ * on the engine thread & every silk verifies its memory survived. each then resets its
+ * arena & exhausts it. one of the silks kills itself rather than returning.
+ * the main thread sets the silk-local slot of each silk before dispatching it & the silk
+ * fills another slot, which are verified along with the arena.
+ * we run the silks twice so the second time the silk instances are re-used & we verify
+ * each starts with an empty arena & zeroed slots (whether it returned or was killed).
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#define __USE_XOPEN_EXTENDED
+#include <unistd.h>
+#include "silk.h"
+
+
+/*
+ * The application-speicifc msg we send to the silks
+ */
+#define SILK_MSG__APP_ARENA_CHECK   SILK_MSG_APP_CODE_FIRST
+
+/*
+ * the number of silks, the pages of their arenas & the size of the buffer each fills
+ */
+#define NUM_SILKS                   4
+#define NUM_ARENA_PAGES             2
+#define BUF_SIZE                    100
+
+/*
+ * the number of msgs each silk processes (& checks its memory) & the silk that kills itself
+ */
+#define DEFAULT_NUM_ROUNDS          20
+#define KILLER_SILK                 1
+
+/*
+ * the interval (in usec) the main thread waits for the silks to progress
+ */
+#define SLEEP_INTERVAL              1000
+
+struct silk_engine_t   engine;
+
+/*
+ * the silk-local storage slots: the index the main thread gave the silk & a buffer the
+ * silk fills
+ */
+static silk_local_key_t   index_key, buf_key;
+
+/*
+ * the number of silks that completed all rounds successfully
+ */
+volatile int   num_silk_done = 0;
+
+
+static void
+ut_arena_idle_cb (struct silk_execution_thread_t   *exec_thr)
+{
+    usleep(SLEEP_INTERVAL);
+}
+
+static void
+ut_arena_check_buf (const unsigned char   *buf,
+                    silk_id_t             silk_id)
+{
+    int    i;
+
+    for (i = 0; i < BUF_SIZE; i++) {
+        assert(buf[i] == (unsigned char)silk_id);
+    }
+}
+
+static void
+ut_arena_entry_func (void *_arg)
+{
+    struct silk_t          *s = silk__my_ctrl();
+    void                   *arena = silk_get_arena_from_id(&engine, s->silk_id);
+    struct silk_msg_t      msg;
+    unsigned char          *first, *buf, *local_buf = silk_local(buf_key);
+    int     i, round;
+
+
+    // the slots are right after the control block, zeroed but for what the main thread set
+    assert(*(intptr_t *)silk_local(index_key) == (intptr_t)_arg + 1);
+    assert((void *)local_buf >= (void *)(s + 1));
+    assert((char *)local_buf + BUF_SIZE <= (char *)s + engine.silk_size);
+    for (i = 0; i < BUF_SIZE; i++) {
+        assert(local_buf[i] == 0);
+    }
+    memset(local_buf, (unsigned char)s->silk_id, BUF_SIZE);
+    // the arena is empty, no matter how the previous run of the silk ended
+    first = silk_arena_alloc(1);
+    assert(first == arena);
+    buf = silk_arena_alloc(BUF_SIZE);
+    assert(buf == first + SILK_ARENA_ALIGN);
+    memset(buf, (unsigned char)s->silk_id, BUF_SIZE);
+    for (round = 0; round < DEFAULT_NUM_ROUNDS; round++) {
+        silk_yield(&msg);
+        assert(msg.msg == SILK_MSG__APP_ARENA_CHECK);
+        ut_arena_check_buf(buf, s->silk_id);
+        ut_arena_check_buf(local_buf, s->silk_id);
+    }
+    if ((intptr_t)_arg == KILLER_SILK) {
+        // die with a used arena
+        silk_kill_id(silk__my_id());
+        assert(0);
+    }
+    silk_arena_reset();
+    assert(silk_arena_alloc(engine.arena_size) == arena);
+    assert(silk_arena_alloc(1) == NULL);
+    __sync_fetch_and_add(&num_silk_done, 1);
+}
+
+/*
+ * allocate & dispatch all the silks, send each a msg per round & wait for all of them
+ * to complete.
+ */
+static void
+ut_arena_run (void)
+{
+    struct silk_msg_t      msg = {
+        .msg = SILK_MSG__APP_ARENA_CHECK,
+        .ctx = NULL,
+    };
+    struct silk_t          *silks[NUM_SILKS];
+    enum silk_status_e     silk_stat;
+    int    i, round;
+
+    num_silk_done = 0;
+    for (i = 0; i < NUM_SILKS; i++) {
+        silk_stat = silk_alloc(&engine, ut_arena_entry_func, (void*)(intptr_t)i, 0, &silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+        assert(*(intptr_t *)silk_get_local(silks[i], index_key) == 0);
+        *(intptr_t *)silk_get_local(silks[i], index_key) = i + 1;
+        silk_stat = silk_dispatch(&engine, silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+    for (round = 0; round < DEFAULT_NUM_ROUNDS; round++) {
+        for (i = 0; i < NUM_SILKS; i++) {
+            msg.silk_id = silks[i]->silk_id;
+            silk_stat = silk_send_msg(&engine, &msg);
+            assert(silk_stat == SILK_STAT_OK);
+        }
+    }
+    while (num_silk_done < NUM_SILKS - 1) {
+        usleep(SLEEP_INTERVAL);
+    }
+    // let the last silk (& the killed one) become free
+    while (engine.num_free_silk != engine.cfg.num_silk) {
+        usleep(SLEEP_INTERVAL);
+    }
+}
+
+
+int main (int   argc, char **argv)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = 0,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = 16,
+        .num_stack_seperator_pages = 4,
+        .num_silk = NUM_SILKS,
+        .num_arena_pages = NUM_ARENA_PAGES,
+        .idle_cb = ut_arena_idle_cb,
+        .ctx = NULL,
+    };
+    enum silk_status_e     silk_stat;
+
+
+    SILK_DEBUG("Initializing Silk engine...");
+    index_key = silk_local_key_register(&silk_cfg, sizeof(intptr_t));
+    buf_key = silk_local_key_register(&silk_cfg, BUF_SIZE);
+    assert(buf_key == sizeof(intptr_t));
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    assert(engine.arena_size == NUM_ARENA_PAGES * PAGE_SIZE);
+    ut_arena_run();
+    printf("arena memory preserved on first run\n");
+    ut_arena_run();
+    printf("arena memory preserved & reset on second run\n");
+
+    silk_stat = silk_terminate(&engine);
+    SILK_DEBUG("Silk termination returns:%d", silk_stat);
+    silk_stat = silk_join(&engine);
+    SILK_DEBUG("Silk join returns:%d", silk_stat);
+    return silk_stat;
+}
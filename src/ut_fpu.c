@@ -0,0 +1,206 @@
+/*
+ * Copyight (C) Eitan Ben-Amos, 2012
+ *
+ * a unit test program to test the preservation of the FPU state of silks which
+ * request it on allocation (SILK_ALLOC_FLAG__FPU_CTRL / SILK_ALLOC_FLAG__FPU_FULL).
+ *
+ * Execution path
+ * we dispatch a few silks, each setting its own rounding mode:
+ * - a silk that preserves the FPU control words & rounds up.
+ * - a silk that preserves the FPU control words & rounds down.
+ * - a silk that preserves the full FPU state & rounds toward zero.
+ * - a silk that preserves nothing (it must always see the engine default rounding mode).
+ * The main thread then sends all of them a msg per round so they are interleaved on the
+ * engine thread & every silk verifies its rounding mode survived the context switches.
+ */
+
+
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <fenv.h>
+#define __USE_XOPEN_EXTENDED
+#include <unistd.h>
+#include "silk.h"
+
+
+/*
+ * The application-speicifc msg we send to the silks
+ */
+#define SILK_MSG__APP_FPU_CHECK     SILK_MSG_APP_CODE_FIRST
+
+/*
+ * the number of msgs each silk processes (& checks its FPU state) before it terminates
+ */
+#define DEFAULT_NUM_ROUNDS          100
+
+/*
+ * the interval (in usec) the main thread waits for the silks to progress
+ */
+#define SLEEP_INTERVAL              1000
+
+/*
+ * the silks we dispatch & the rounding mode each of them uses
+ */
+struct ut_fpu_silk_desc_t {
+    const char   *name;
+    uint32_t      alloc_flags;
+    int           round_mode;
+};
+static const struct ut_fpu_silk_desc_t   silk_desc[] = {
+    { "up",          SILK_ALLOC_FLAG__FPU_CTRL, FE_UPWARD },
+    { "down",        SILK_ALLOC_FLAG__FPU_CTRL, FE_DOWNWARD },
+    { "toward zero", SILK_ALLOC_FLAG__FPU_FULL, FE_TOWARDZERO },
+    { "default",     0,                         FE_TONEAREST },
+};
+#define NUM_SILKS    (sizeof(silk_desc) / sizeof(silk_desc[0]))
+
+struct silk_engine_t   engine;
+
+/*
+ * the number of silks that completed all rounds successfully
+ */
+volatile int   num_silk_done = 0;
+
+
+static void
+ut_fpu_idle_cb (struct silk_execution_thread_t   *exec_thr)
+{
+    usleep(SLEEP_INTERVAL);
+}
+
+/*
+ * verify the rounding mode in effect on the CPU in both the x87 control word & the MXCSR.
+ * both keep the rounding control in 2 bits using the same encoding (x87 at bits 10-11,
+ * MXCSR at bits 13-14) which is also the value of the FE_* macros.
+ */
+static void
+ut_fpu_check_round_mode (const struct ut_fpu_silk_desc_t   *desc)
+{
+    struct silk_fpu_ctrl_t   ctrl;
+    volatile double          one = 1.0, three = 3.0;
+    double                   third;
+
+    silk_fpu_save_ctrl(&ctrl);
+    assert((ctrl.x87_cw & 0xc00) == desc->round_mode);
+    assert(((ctrl.mxcsr >> 3) & 0xc00) == desc->round_mode);
+    assert(fegetround() == desc->round_mode);
+    // make sure the rounding mode actually affects the calculation
+    third = one / three;
+    if (desc->round_mode == FE_UPWARD) {
+        assert(third * three > one);
+    } else if (desc->round_mode == FE_DOWNWARD || desc->round_mode == FE_TOWARDZERO) {
+        assert(third * three < one);
+    }
+}
+
+static void
+ut_fpu_entry_func (void *_arg)
+{
+    const struct ut_fpu_silk_desc_t   *desc = &silk_desc[(int)(intptr_t)_arg];
+    struct silk_t                     *s = silk__my_ctrl();
+    struct silk_msg_t                  msg;
+    int     round;
+
+
+    SILK_DEBUG("Silk#%d rounding %s starts", s->silk_id, desc->name);
+    // we run with the engine defaults no matter what the silks before us did
+    assert(fegetround() == FE_TONEAREST);
+    if (desc->round_mode != FE_TONEAREST) {
+        fesetround(desc->round_mode);
+    }
+    for (round = 0; round < DEFAULT_NUM_ROUNDS; round++) {
+        ut_fpu_check_round_mode(desc);
+        silk_yield(&msg);
+        assert(msg.msg == SILK_MSG__APP_FPU_CHECK);
+        ut_fpu_check_round_mode(desc);
+    }
+    SILK_DEBUG("Silk#%d rounding %s ends", s->silk_id, desc->name);
+    __sync_fetch_and_add(&num_silk_done, 1);
+}
+
+/*
+ * allocate & dispatch all the silks. each gets its index in silk_desc[] as argument.
+ */
+static void
+ut_fpu_dispatch (struct silk_t   *silks[])
+{
+    enum silk_status_e     silk_stat;
+    int    i;
+
+    for (i = 0; i < NUM_SILKS; i++) {
+        silk_stat = silk_alloc(&engine, ut_fpu_entry_func, (void*)(intptr_t)i,
+                               silk_desc[i].alloc_flags, &silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+        silk_stat = silk_dispatch(&engine, silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+}
+
+/*
+ * send each silk a msg per round & wait for all of them to complete.
+ */
+static void
+ut_fpu_run_rounds (struct silk_t   *silks[])
+{
+    struct silk_msg_t      msg = {
+        .msg = SILK_MSG__APP_FPU_CHECK,
+        .ctx = NULL,
+    };
+    enum silk_status_e     silk_stat;
+    int    i, round;
+
+    num_silk_done = 0;
+    for (round = 0; round < DEFAULT_NUM_ROUNDS; round++) {
+        for (i = 0; i < NUM_SILKS; i++) {
+            msg.silk_id = silks[i]->silk_id;
+            silk_stat = silk_send_msg(&engine, &msg);
+            assert(silk_stat == SILK_STAT_OK);
+        }
+    }
+    while (num_silk_done < NUM_SILKS) {
+        usleep(SLEEP_INTERVAL);
+    }
+    // let the last silk mark itself as free
+    while (engine.num_free_silk != engine.cfg.num_silk) {
+        usleep(SLEEP_INTERVAL);
+    }
+}
+
+
+int main (int   argc, char **argv)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = 0,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = 16,
+        .num_stack_seperator_pages = 4,
+        .num_silk = NUM_SILKS,
+        .idle_cb = ut_fpu_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_t          *silks[NUM_SILKS];
+    enum silk_status_e     silk_stat;
+
+
+    SILK_DEBUG("Initializing Silk engine...");
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    /*
+     * run the silks twice so the second time the silk instances are re-used with
+     * different allocation flags & we verify none inherits the FPU state of its
+     * previous incarnation.
+     */
+    ut_fpu_dispatch(silks);
+    ut_fpu_run_rounds(silks);
+    printf("FPU rounding modes preserved on first run\n");
+    ut_fpu_dispatch(silks);
+    ut_fpu_run_rounds(silks);
+    printf("FPU rounding modes preserved on second run\n");
+
+    silk_stat = silk_terminate(&engine);
+    SILK_DEBUG("Silk termination returns:%d", silk_stat);
+    silk_stat = silk_join(&engine);
+    SILK_DEBUG("Silk join returns:%d", silk_stat);
+    return silk_stat;
+}
@@ -8,6 +8,8 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <inttypes.h>
 #include <errno.h>
 #include <assert.h>
 #define __USE_XOPEN_EXTENDED
@@ -167,10 +169,12 @@ struct test_4_param_t {
  *    size & ABI requirements like:
  * IA32 has a stack frame size aligned on 8 bytes.
  * x86-64 uses many register for parameter passing hence pushing less to stack.
+ * 3) silk__main() keeps the msg it receives on its frame, so the size of a msg (which
+ *    depends on SILK_MSG_INLINE_SIZE) is added.
  */
 #define TEST_4_SHALLOW_RECURSION_DEPTH       1
 #define TEST_4_DEEP_RECURSION_DEPTH          1000
-#define MAX_SHALLOW_STACK_OFFSET             256
+#define MAX_SHALLOW_STACK_OFFSET             (256 + sizeof(struct silk_msg_t))
 #define MIN_DEEP_STACK_OFFSET        (TEST_4_DEEP_RECURSION_DEPTH * (8 * 1)) // for IA32
 
 
@@ -193,8 +197,8 @@ wait_on_bool(volatile bool   *b,
 }
 
 static void
-wait_on_uint32(volatile uint32_t   *val,
-               uint32_t             exit_value)
+wait_on_uintptr(volatile uintptr_t   *val,
+                uintptr_t            exit_value)
 {
     while (*val != exit_value) {
         usleep(SLEEP_INTERVAL);
@@ -303,7 +307,7 @@ ut_kill__recurse_n(int    *p_dummy,
 static void
 ut_kill__main(void *_arg)
 {
-    enum ut_kill_silk_operation   oper = (enum ut_kill_silk_operation)_arg;
+    enum ut_kill_silk_operation   oper = (enum ut_kill_silk_operation)(intptr_t)_arg;
     struct silk_t                 *s = silk__my_ctrl();
     struct silk_msg_t             msg;
     int my_dummy = 0;
@@ -377,7 +381,7 @@ ut_kill__kill_other_silk(void *_arg)
 static void
 ut_kill__post_kill_entry_func(void *_arg)
 {
-    int      rep = (int)_arg;
+    int      rep = (int)(intptr_t)_arg;
 
     SILK_DEBUG("Silk#%d starts executing post kill code. rep=%d (stack_addr=%p)",
                silk__my_id(), rep, &rep);
@@ -409,7 +413,7 @@ int main (int   argc, char **argv)
     uintptr_t              arg;
     enum silk_status_e     silk_stat;
     int    rep;
-    long   fresh_silk_stk_frame_offset_from_initial_stk_addr;
+    ptrdiff_t   fresh_silk_stk_frame_offset_from_initial_stk_addr;
 
 
     // set CLI defaults
@@ -433,7 +437,7 @@ int main (int   argc, char **argv)
 
     // Test 4 preparations (before we alloc/dispatch any silk)
     SILK_DEBUG("Dispatching the first silk to take the offset of initial frame from initial stack address")
-    silk_stat = silk_alloc(&engine, ut_kill__post_kill_entry_func, (void*)NULL, &s);
+    silk_stat = silk_alloc(&engine, ut_kill__post_kill_entry_func, (void*)NULL, 0, &s);
     assert(silk_stat == SILK_STAT_OK);
     assert(engine.num_free_silk == opt.num_silk - 1);
     silk_stat = silk_dispatch(&engine, s);
@@ -443,13 +447,13 @@ int main (int   argc, char **argv)
                silk_get_initial_stack_from_id(&engine, s->silk_id));
     fresh_silk_stk_frame_offset_from_initial_stk_addr =
         silk_get_initial_stack_from_id(&engine, s->silk_id) - test_4.post_kill_top_stack_frame_addr;
-    SILK_DEBUG("A fresh Silk uses 0x%x bytes of stack from inital addres (till first frame)",
+    SILK_DEBUG("A fresh Silk uses 0x%tx bytes of stack from inital addres (till first frame)",
                fresh_silk_stk_frame_offset_from_initial_stk_addr);
 
 
     // Test 1 : terminate a non dispacthed silk
     printf("Test Case 1\n");
-    silk_stat = silk_alloc(&engine, ut_kill__main, (void*)NULL, &s);
+    silk_stat = silk_alloc(&engine, ut_kill__main, (void*)NULL, 0, &s);
     assert(silk_stat == SILK_STAT_OK);
     SILK_DEBUG("allocated silk No %d", s->silk_id);
     assert(engine.num_free_silk == opt.num_silk - 1);
@@ -461,7 +465,7 @@ int main (int   argc, char **argv)
 
     // Test 2: terminate a dispatched silk that ends without calling yield.
     printf("Test Case 2\n");
-    silk_stat = silk_alloc(&engine, ut_kill__main, (void*)INFINITE_BUSY_WAIT_AND_EXIT, &s);
+    silk_stat = silk_alloc(&engine, ut_kill__main, (void*)INFINITE_BUSY_WAIT_AND_EXIT, 0, &s);
     assert(silk_stat == SILK_STAT_OK);
     SILK_DEBUG("allocated silk No %d", s->silk_id);
     silk_stat = silk_dispatch(&engine, s);
@@ -484,7 +488,7 @@ int main (int   argc, char **argv)
      * Test 3: terminate a dispatched silk that yields after we killed it
      */
     printf("Test Case 3\n");
-    silk_stat = silk_alloc(&engine, ut_kill__main, (void*)YIELD_POST_KILL, &s);
+    silk_stat = silk_alloc(&engine, ut_kill__main, (void*)YIELD_POST_KILL, 0, &s);
     assert(silk_stat == SILK_STAT_OK);
     SILK_DEBUG("allocated silk No %d", s->silk_id);
     silk_stat = silk_dispatch(&engine, s);
@@ -508,12 +512,12 @@ int main (int   argc, char **argv)
     SILK_DEBUG("Now allocate a silk, make sure its the same instance we killed,"
                " dispatch it to see it running fine.");
     arg = UT_KILL__MAGIC_1;
-    silk_stat = silk_alloc(&engine, ut_kill__set_val, (void*)&arg, &s2);
+    silk_stat = silk_alloc(&engine, ut_kill__set_val, (void*)&arg, 0, &s2);
     assert(silk_stat == SILK_STAT_OK);
     assert(s2->silk_id == s->silk_id);
     silk_stat = silk_dispatch(&engine, s2);
     assert(silk_stat == SILK_STAT_OK);
-    wait_on_uint32(&arg, UT_KILL__MAGIC_1 + 1234);
+    wait_on_uintptr(&arg, UT_KILL__MAGIC_1 + 1234);
     assert(engine.num_free_silk == opt.num_silk);
 
 
@@ -542,7 +546,7 @@ int main (int   argc, char **argv)
     uintptr_t   stk_used;
     silk_id_t   expected_silk_id = s->silk_id;
     void        *prev_top = NULL, *prev_bottom = NULL;
-    long        shallow_addr_difference;
+    ptrdiff_t   shallow_addr_difference;
 
 
     printf("Test Case 4\n");
@@ -586,7 +590,7 @@ int main (int   argc, char **argv)
 
                 // dipatch the first silk (to be killed in some way)
                 silk_stat = silk_alloc(&engine, ut_kill__main,
-                                       (void*)SHALLOW_DEEP_RECURSION_STACK, &s);
+                                       (void*)SHALLOW_DEEP_RECURSION_STACK, 0, &s);
                 assert(silk_stat == SILK_STAT_OK);
                 if (test_4.code_path != SILK_KILL__OTHER_SILK_ON_RET) {
                     assert(s->silk_id == expected_silk_id);
@@ -600,7 +604,7 @@ int main (int   argc, char **argv)
 
                 case SILK_KILL__OTHER_SILK_ON_YEILD:
                     wait_on_bool(&test_4.has_called_yield, true);
-                    silk_stat = silk_alloc(&engine, ut_kill__kill_other_silk, s, &s2);
+                    silk_stat = silk_alloc(&engine, ut_kill__kill_other_silk, s, 0, &s2);
                     assert(silk_stat == SILK_STAT_OK);
                     SILK_DEBUG("start another silk (#%d) to kill the first one", s2->silk_id);
                     assert(s2->silk_id != expected_silk_id);
@@ -612,7 +616,7 @@ int main (int   argc, char **argv)
 
                 case SILK_KILL__OTHER_SILK_ON_RET:
                     wait_on_bool(&test_4.is_busy_waiting, true);
-                    silk_stat = silk_alloc(&engine, ut_kill__kill_other_silk, s, &s2);
+                    silk_stat = silk_alloc(&engine, ut_kill__kill_other_silk, s, 0, &s2);
                     assert(silk_stat == SILK_STAT_OK);
                     /*
                      * in this code path, the 2 silks we allocate are freed in opposite order
@@ -642,7 +646,7 @@ int main (int   argc, char **argv)
 #ifdef MULTI_THREAD_ENGINE
                 case SILK_KILL__OTHER_SILK_AND_RET:
                     wait_on_bool(&test_4.is_busy_waiting, true);
-                    silk_stat = silk_alloc(&engine, ut_kill__kill_other_silk, s, &s2);
+                    silk_stat = silk_alloc(&engine, ut_kill__kill_other_silk, s, 0, &s2);
                     assert(silk_stat == SILK_STAT_OK);
                     SILK_DEBUG("start another silk (#%d) to kill the first one", s2->silk_id);
                     assert(s2->silk_id != expected_silk_id);
@@ -664,7 +668,7 @@ int main (int   argc, char **argv)
                     SILK_DEBUG("SHALLOW: top_stack_frame_addr=%p, bottom_stack_frame_addr=%p",
                                test_4.top_stack_frame_addr, test_4.bottom_stack_frame_addr);
                     stk_used = start_stk_addr - (uintptr_t)test_4.top_stack_frame_addr;
-                    SILK_DEBUG("stack being used by SHALLOW silk code:0x%x Bytes", stk_used);
+                    SILK_DEBUG("stack being used by SHALLOW silk code:0x%" PRIxPTR " Bytes", stk_used);
                     assert(stk_used < MAX_SHALLOW_STACK_OFFSET);
                     break;
 
@@ -672,7 +676,7 @@ int main (int   argc, char **argv)
                     SILK_DEBUG("DEEP: top_stack_frame_addr=%p, bottom_stack_frame_addr=%p",
                                test_4.top_stack_frame_addr, test_4.bottom_stack_frame_addr);
                     stk_used = start_stk_addr - (uintptr_t)test_4.bottom_stack_frame_addr;
-                    SILK_DEBUG("stack being used by DEEP silk code:0x%x Bytes", stk_used);
+                    SILK_DEBUG("stack being used by DEEP silk code:0x%" PRIxPTR " Bytes", stk_used);
                     assert(stk_used > MIN_DEEP_STACK_OFFSET);
                     break;
 
@@ -700,7 +704,7 @@ int main (int   argc, char **argv)
 #define UT_KILL_MAX_SILKS_USED_IN_CODE_PATH   2
                 typedef struct silk_t* p_silk_t;
                 p_silk_t  silks[UT_KILL_MAX_SILKS_USED_IN_CODE_PATH];
-                long      addr_difference;
+                ptrdiff_t addr_difference;
 
 
                 /*
@@ -711,7 +715,7 @@ int main (int   argc, char **argv)
                  */
                 for (int i=0; i < UT_KILL_MAX_SILKS_USED_IN_CODE_PATH; i++) {
                     silk_stat = silk_alloc(&engine, ut_kill__post_kill_entry_func,
-                                           (void*)rep, &silks[i]);
+                                           (void*)(intptr_t)rep, 0, &silks[i]);
                     assert(silk_stat == SILK_STAT_OK);
                 }
                 /*
@@ -730,7 +734,7 @@ int main (int   argc, char **argv)
                     // check the silk result
                     // verify the stack address it finds is roughly where we see it in fresh silks.
                     addr_difference = silk_get_initial_stack_from_id(&engine, silks[i]->silk_id) - test_4.post_kill_top_stack_frame_addr;
-                    SILK_DEBUG("post_kill_top_stack_frame_addr=%p, addr_difference=0x%lx",
+                    SILK_DEBUG("post_kill_top_stack_frame_addr=%p, addr_difference=0x%tx",
                     test_4.post_kill_top_stack_frame_addr, addr_difference);
                     // check how much stack we used - not too much!!!
                     assert(addr_difference <  MAX_SHALLOW_STACK_OFFSET);
@@ -0,0 +1,365 @@
+/*
+ * Copyight (C) Eitan Ben-Amos, 2012
+ *
+ * a unit test program to test the msgs sent to silks & the pool of their payloads.
+ *
+ * Execution path
+ * the main thread (an external producer) allocates payloads from the pool of the engine,
+ * fills them & sends them to a few silks, many more times than there are payloads in the
+ * pool. it retries when the pool is exhausted, so the payloads must be freed once the
+ * silks are done with them. each silk verifies the payload it received & that it got
+ * the payloads in order. when all silks are done, we verify every payload made it back
+ * to the pool (or to one of the caches). we do it again through a msg queue much smaller
+ * than the msgs we send (so we retry when it is full). a msg queue on its own must hold
+ * exactly its size in msgs (with either scheduler), lap after lap.
+ * when the msgs carry payloads inline (SILK_MSG_INLINE_SIZE), we then do the same with
+ * payloads carried inline in the msgs, which need no pool.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#define __USE_XOPEN_EXTENDED
+#include <unistd.h>
+#include "silk.h"
+
+
+/*
+ * The application-speicifc msg we send to the silks
+ */
+#define SILK_MSG__APP_PAYLOAD       SILK_MSG_APP_CODE_FIRST
+
+/*
+ * the number of silks, the number of msgs each receives & the number of payloads
+ */
+#define NUM_SILKS                   4
+#define NUM_ROUNDS                  100
+#define NUM_PAYLOADS                64
+// the smallest msg queue that boots the silks
+#define MSG_QUEUE_SIZE              (2 * NUM_SILKS)
+
+/*
+ * the interval (in usec) the main thread waits for the silks to progress
+ */
+#define SLEEP_INTERVAL              1000
+
+/*
+ * the payload the main thread sends to the silks
+ */
+struct ut_msg_payload_t {
+    silk_id_t   silk_id;
+    int         round;
+    char        text[40];
+};
+
+struct silk_engine_t   engine;
+
+/*
+ * the number of silks that completed all rounds successfully
+ */
+volatile int   num_silk_done = 0;
+
+
+static void
+ut_msg_idle_cb (struct silk_execution_thread_t   *exec_thr)
+{
+    usleep(SLEEP_INTERVAL);
+}
+
+/*
+ * receive the msgs of all rounds. "_arg" tells whether their payload is inline or pooled.
+ */
+static void
+ut_msg_payload_entry_func (void *_arg)
+{
+    struct silk_t                   *s = silk__my_ctrl();
+    struct silk_msg_t               msg;
+    const struct ut_msg_payload_t   *payload;
+    bool    is_inline = (bool)(intptr_t)_arg;
+#if SILK_MSG_INLINE_SIZE > 0
+    size_t  len;
+#endif
+    int     round;
+
+
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        silk_yield(&msg);
+        assert(msg.msg == SILK_MSG__APP_PAYLOAD);
+        if (is_inline) {
+#if SILK_MSG_INLINE_SIZE > 0
+            assert(!(msg.flags & SILK_MSG_FLAG__PAYLOAD));
+            payload = silk_msg_inline_data(&msg, &len);
+            assert(len == sizeof(*payload));
+#else
+            assert(0); // the inline API is compiled out
+#endif
+        } else {
+            assert(msg.flags & SILK_MSG_FLAG__PAYLOAD);
+#if SILK_MSG_INLINE_SIZE > 0
+            assert(silk_msg_inline_data(&msg, &len) == NULL);
+#endif
+            payload = msg.ctx;
+            assert(((uintptr_t)payload & (SILK_PAYLOAD_ALIGN - 1)) == 0);
+        }
+        assert(payload->silk_id == s->silk_id);
+        assert(payload->round == round);
+        assert(strcmp(payload->text, "payload") == 0);
+    }
+    __sync_fetch_and_add(&num_silk_done, 1);
+}
+
+/*
+ * count the free payloads in the pool & all the caches
+ */
+static uint32_t
+ut_msg_num_free_payloads (void)
+{
+    uint32_t   num_free = engine.num_free_payload + engine.exec_thr.payload_cache.num;
+    int        i;
+
+    for (i = 0; i < SILK_PAYLOAD_NUM_CACHES; i++) {
+        num_free += engine.payload_cache[i].num;
+    }
+    return num_free;
+}
+
+/*
+ * the engine must be cache-line aligned & the msg queue size must be a power of 2 & hold the
+ * msgs booting the silks
+ */
+static void
+ut_msg_queue_size (void)
+{
+    static uint8_t                misaligned_buf[sizeof(struct silk_engine_t) + SILK_CACHE_LINE_SIZE]
+        SILK_CACHE_ALIGNED;
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = 0,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = 16,
+        .num_stack_seperator_pages = 4,
+        .num_silk = NUM_SILKS,
+        .msg_queue_size = MSG_QUEUE_SIZE,
+        .idle_cb = ut_msg_idle_cb,
+        .ctx = NULL,
+    };
+
+    assert(silk_init((struct silk_engine_t*)(misaligned_buf + 16), &silk_cfg) ==
+           SILK_STAT_ENGINE_MISALIGNED);
+    silk_cfg.msg_queue_size = MSG_QUEUE_SIZE - 1;
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_MSG_QUEUE_SIZE);
+    silk_cfg.msg_queue_size = MSG_QUEUE_SIZE / 2;
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_MSG_QUEUE_SIZE);
+}
+
+/*
+ * fill a msg queue to its size & drain it, a few laps around the ring. both schedulers
+ * hold exactly "size" msgs.
+ */
+static void
+ut_msg_queue_full (void)
+{
+    static struct silk_incoming_msg_queue_t   q;
+    struct silk_msg_t      msg = {
+        .msg = SILK_MSG__APP_PAYLOAD,
+    };
+    uint32_t   lap, i;
+
+    assert(silk_sched_init(&q, MSG_QUEUE_SIZE) == SILK_STAT_OK);
+    for (lap = 0; lap < 3; lap++) {
+        for (i = 0; i < MSG_QUEUE_SIZE; i++) {
+            assert(!silk_sched_is_full(&q));
+            msg.silk_id = i;
+            assert(silk_sched_send(&q, &msg) == SILK_STAT_OK);
+            assert(_silk_sched_get_q_size(&q) == i + 1);
+        }
+        assert(silk_sched_is_full(&q));
+        assert(silk_sched_send(&q, &msg) == SILK_STAT_Q_FULL);
+        assert(_silk_sched_get_q_size(&q) == MSG_QUEUE_SIZE);
+        for (i = 0; i < MSG_QUEUE_SIZE; i++) {
+            assert(silk_sched_get_next(&q, &msg));
+            assert(msg.silk_id == i);
+        }
+        assert(silk_sched_is_empty(&q));
+        assert(!silk_sched_get_next(&q, &msg));
+        assert(_silk_sched_get_q_size(&q) == 0);
+    }
+    silk_sched_terminate(&q);
+}
+
+/*
+ * send pooled payloads through a msg queue of "msg_queue_size" msgs (0 for the default)
+ */
+static void
+ut_msg_payload (uint32_t   msg_queue_size)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = 0,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = 16,
+        .num_stack_seperator_pages = 4,
+        .num_silk = NUM_SILKS,
+        .msg_queue_size = msg_queue_size,
+        .payload_size = sizeof(struct ut_msg_payload_t),
+        .num_payloads = 0,
+        .idle_cb = ut_msg_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_t              *silks[NUM_SILKS];
+    struct ut_msg_payload_t    *payload[NUM_PAYLOADS];
+    enum silk_status_e         silk_stat;
+    int    i, round, num_alloc;
+
+
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_PAYLOAD_POOL);
+    silk_cfg.num_payloads = NUM_PAYLOADS;
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    assert(ut_msg_num_free_payloads() == NUM_PAYLOADS);
+
+    // exhaust the pool & give it all back
+    for (num_alloc = 0; num_alloc < NUM_PAYLOADS; num_alloc++) {
+        payload[num_alloc] = silk_payload_alloc(&engine);
+        assert(payload[num_alloc] != NULL);
+    }
+    assert(silk_payload_alloc(&engine) == NULL);
+    for (i = 0; i < num_alloc; i++) {
+        silk_payload_free(&engine, payload[i]);
+    }
+    assert(ut_msg_num_free_payloads() == NUM_PAYLOADS);
+
+    num_silk_done = 0;
+    for (i = 0; i < NUM_SILKS; i++) {
+        silk_stat = silk_alloc(&engine, ut_msg_payload_entry_func, NULL, 0, &silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+        silk_stat = silk_dispatch(&engine, silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        for (i = 0; i < NUM_SILKS; i++) {
+            // wait for the silks to free the payloads they are done with
+            while ((payload[0] = silk_payload_alloc(&engine)) == NULL) {
+                usleep(SLEEP_INTERVAL);
+            }
+            payload[0]->silk_id = silks[i]->silk_id;
+            payload[0]->round = round;
+            strcpy(payload[0]->text, "payload");
+            // wait for the engine to drain the queue
+            while ((silk_stat = silk_send_msg_payload(&engine, SILK_MSG__APP_PAYLOAD,
+                                                      silks[i]->silk_id,
+                                                      payload[0])) == SILK_STAT_Q_FULL) {
+                usleep(SLEEP_INTERVAL);
+            }
+            assert(silk_stat == SILK_STAT_OK);
+        }
+    }
+    while (num_silk_done < NUM_SILKS) {
+        usleep(SLEEP_INTERVAL);
+    }
+    // the last payload of each silk is freed once it is free
+    while (engine.num_free_silk != engine.cfg.num_silk) {
+        usleep(SLEEP_INTERVAL);
+    }
+    assert(ut_msg_num_free_payloads() == NUM_PAYLOADS);
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+}
+
+#if SILK_MSG_INLINE_SIZE > 0
+static void
+ut_msg_inline (void)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = 0,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = 16,
+        .num_stack_seperator_pages = 4,
+        .num_silk = NUM_SILKS,
+        .msg_queue_size = MSG_QUEUE_SIZE,
+        .idle_cb = ut_msg_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_t              *silks[NUM_SILKS];
+    struct ut_msg_payload_t    payload = {
+        .text = "payload",
+    };
+    char                       too_large[SILK_MSG_INLINE_SIZE + 1];
+    enum silk_status_e         silk_stat;
+    int    i, round;
+
+
+#if SILK_MSG_INLINE_SIZE == 48
+    // a msg fits in a single cache line
+    assert(sizeof(struct silk_msg_t) == 64);
+#endif
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_send_msg_inline(&engine, SILK_MSG__APP_PAYLOAD, SILK_INITIAL_ID,
+                                     too_large, sizeof(too_large));
+    assert(silk_stat == SILK_STAT_MSG_TOO_LARGE);
+    if (sizeof(payload) > SILK_MSG_INLINE_SIZE) {
+        printf("payload of %zu bytes cant be inline (SILK_MSG_INLINE_SIZE=%d). skipping\n",
+               sizeof(payload), SILK_MSG_INLINE_SIZE);
+        goto out;
+    }
+
+    num_silk_done = 0;
+    for (i = 0; i < NUM_SILKS; i++) {
+        silk_stat = silk_alloc(&engine, ut_msg_payload_entry_func, (void*)(intptr_t)true, 0,
+                               &silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+        silk_stat = silk_dispatch(&engine, silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+    // the payload is copied on send, so we reuse it for all msgs
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        for (i = 0; i < NUM_SILKS; i++) {
+            payload.silk_id = silks[i]->silk_id;
+            payload.round = round;
+            // wait for the engine to drain the queue
+            while ((silk_stat = silk_send_msg_inline(&engine, SILK_MSG__APP_PAYLOAD,
+                                                     silks[i]->silk_id, &payload,
+                                                     sizeof(payload))) == SILK_STAT_Q_FULL) {
+                usleep(SLEEP_INTERVAL);
+            }
+            assert(silk_stat == SILK_STAT_OK);
+        }
+    }
+    while (num_silk_done < NUM_SILKS) {
+        usleep(SLEEP_INTERVAL);
+    }
+    while (engine.num_free_silk != engine.cfg.num_silk) {
+        usleep(SLEEP_INTERVAL);
+    }
+
+ out:
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+}
+#endif // SILK_MSG_INLINE_SIZE > 0
+
+
+int main (int   argc, char **argv)
+{
+    ut_msg_queue_size();
+    printf("engine alignment & msg queue size validation passed\n");
+    ut_msg_queue_full();
+    printf("msg queue full at its size passed\n");
+    ut_msg_payload(0);
+    printf("msg payload pool passed\n");
+    ut_msg_payload(MSG_QUEUE_SIZE);
+    printf("msg payload pool through a small msg queue passed\n");
+#if SILK_MSG_INLINE_SIZE > 0
+    ut_msg_inline();
+    printf("inline msg payload passed\n");
+#else
+    printf("inline msg payload compiled out (SILK_MSG_INLINE_SIZE=0). skipping\n");
+#endif
+    return 0;
+}
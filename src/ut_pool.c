@@ -0,0 +1,346 @@
+/*
+ * Copyight (C) Eitan Ben-Amos, 2012
+ *
+ * a unit test program to test the growth (& shrinking) of the silk pool at runtime.
+ *
+ * Execution path
+ * the engine boots a few silks & may grow to many more. the main thread allocates &
+ * dispatches silks until the pool is at its maximum (so the pool grows in chunks & the
+ * grown silks boot lazily), verifies no more silks can be allocated & then sends each
+ * silk a msg which it waits for. once all silks are free, the idle processing shrinks the
+ * pool back to the booted silks. a msg to a released silk is rejected (or dropped by the
+ * engine, if it was queued before the shrink). we then grow it again (so released silks are re-used)
+ * & kill a few of the grown silks so they are recycled.
+ * a second engine grows over a few stack segments (the stacks of the grown silks are
+ * reserved a segment at a time) & shrinks back, releasing them.
+ * finally, a third engine hibernates the waiting silks while it grows & shrinks a few times
+ * (so the hibernation scan runs over a pool which shrank below it).
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#define __USE_XOPEN_EXTENDED
+#include <unistd.h>
+#include "silk.h"
+
+
+/*
+ * The application-speicifc msg we send to the silks
+ */
+#define SILK_MSG__APP_POOL          SILK_MSG_APP_CODE_FIRST
+
+/*
+ * the number of silks booted by the engine, the maximal number of silks & the number
+ * of silks the pool grows by
+ */
+#define NUM_BOOT_SILKS              4
+#define MAX_SILKS                   40
+#define NUM_GROW_SILKS              8
+// the pool of the second engine spans 2.5 stack segments & grows faster
+#define MAX_SEG_SILKS               (NUM_BOOT_SILKS + 2 * SILK_STACK_SEG_SILKS + SILK_STACK_SEG_SILKS / 2)
+#define NUM_SEG_GROW_SILKS          256
+// the number of times the pool of the third engine grows & shrinks back
+#define NUM_HIBERNATE_ROUNDS        5
+
+/*
+ * the interval (in usec) the main thread waits for the silks to progress
+ */
+#define SLEEP_INTERVAL              1000
+
+struct silk_engine_t   engine;
+
+/*
+ * the number of silks that started & got their msg
+ */
+volatile int   num_silk_started = 0;
+volatile int   num_silk_done = 0;
+
+
+static void
+ut_pool_idle_cb (struct silk_execution_thread_t   *exec_thr)
+{
+    usleep(SLEEP_INTERVAL);
+}
+
+static void
+ut_pool_entry_func (void *_arg)
+{
+    struct silk_t          *s = silk__my_ctrl();
+    struct silk_msg_t      msg;
+    uintptr_t   stack = (uintptr_t)silk_get_stack_from_id(&engine, s->silk_id);
+
+
+    // the silk of our stack address is us, both ways
+    assert(silk_get_id_from_stack(&engine, &msg) == s->silk_id);
+    assert(((uintptr_t)&msg >= stack) &&
+           ((uintptr_t)&msg < stack + silk_get_stack_size_from_id(&engine, s->silk_id)));
+    __sync_fetch_and_add(&num_silk_started, 1);
+    silk_yield(&msg);
+    assert(msg.msg == SILK_MSG__APP_POOL);
+    assert(msg.silk_id == s->silk_id);
+    __sync_fetch_and_add(&num_silk_done, 1);
+}
+
+/*
+ * allocate & dispatch silks until the pool is at its maximum
+ */
+static void
+ut_pool_fill (struct silk_t   **silks,
+              int             num)
+{
+    struct silk_t          *s;
+    enum silk_status_e     silk_stat;
+    int    i;
+
+    num_silk_started = 0;
+    num_silk_done = 0;
+    for (i = 0; i < num; i++) {
+        silk_stat = silk_alloc(&engine, ut_pool_entry_func, NULL, 0, &silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+        // the booted silks are allocated first
+        assert((i < NUM_BOOT_SILKS) == (silks[i]->silk_id < NUM_BOOT_SILKS));
+        assert(engine.cfg.num_silk >= i + 1);
+        silk_stat = silk_dispatch(&engine, silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+    assert(engine.cfg.num_silk == num);
+    assert(silk_alloc(&engine, ut_pool_entry_func, NULL, 0, &s) == SILK_STAT_NO_FREE_SILK);
+    while (num_silk_started < num) {
+        usleep(SLEEP_INTERVAL);
+    }
+}
+
+/*
+ * wait for the silks to become free & for the pool to shrink back to the booted silks
+ */
+static void
+ut_pool_wait_shrink (int   num_done)
+{
+    while (num_silk_done < num_done) {
+        usleep(SLEEP_INTERVAL);
+    }
+    while (engine.cfg.num_silk != NUM_BOOT_SILKS) {
+        usleep(SLEEP_INTERVAL);
+    }
+    assert(engine.num_free_silk == NUM_BOOT_SILKS);
+    assert(engine.stack_class[0].num_silk == NUM_BOOT_SILKS);
+}
+
+/*
+ * send our msg to each of the silks
+ */
+static void
+ut_pool_send (struct silk_t   **silks,
+              int             num)
+{
+    struct silk_msg_t      msg = {
+        .msg = SILK_MSG__APP_POOL,
+        .ctx = NULL,
+    };
+    enum silk_status_e     silk_stat;
+    int    i;
+
+    for (i = 0; i < num; i++) {
+        msg.silk_id = silks[i]->silk_id;
+        silk_stat = silk_send_msg(&engine, &msg);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+}
+
+/*
+ * a msg to a silk which was released when the pool shrank is rejected. one which raced
+ * with the shrink (we queue it directly) is dropped by the engine.
+ */
+static void
+ut_pool_stale_msg (silk_id_t   silk_id)
+{
+    struct silk_msg_t      msg = {
+        .msg = SILK_MSG__APP_POOL,
+        .silk_id = silk_id,
+        .ctx = NULL,
+    };
+    uint64_t   num_stale = engine.num_stale_msg;
+
+    assert(silk_id >= engine.cfg.num_silk);
+    assert(silk_send_msg(&engine, &msg) == SILK_STAT_INVALID_SILK_ID);
+    assert(silk_sched_send(&engine.msg_sched, &msg) == SILK_STAT_OK);
+    while (engine.num_stale_msg == num_stale) {
+        usleep(SLEEP_INTERVAL);
+    }
+    assert(engine.cfg.num_silk == NUM_BOOT_SILKS);
+}
+
+/*
+ * grow a pool over a few stack segments & shrink it back
+ */
+static void
+ut_pool_segments (void)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = SILK_CFG_FLAG_POOL_SHRINK | SILK_CFG_FLAG_STACK_COMMIT_LAZY,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = 4,
+        .num_stack_seperator_pages = 1,
+        .num_silk = NUM_BOOT_SILKS,
+        .max_silk = MAX_SEG_SILKS,
+        .num_grow_silks = NUM_SEG_GROW_SILKS,
+        .idle_cb = ut_pool_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_t          **silks = malloc(MAX_SEG_SILKS * sizeof(*silks));
+    enum silk_status_e     silk_stat;
+    int    i;
+
+
+    assert(silks != NULL);
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    // the stack area has just the booted silks & no segment is reserved yet
+    assert(engine.stack_area_size < 2 * NUM_BOOT_SILKS * engine.stack_class[0].padded_stack_size);
+    assert(engine.num_stack_segs == 3);
+    for (i = 0; i < engine.num_stack_segs; i++) {
+        assert(engine.stack_seg[i] == NULL);
+    }
+
+    ut_pool_fill(silks, MAX_SEG_SILKS);
+    for (i = 0; i < engine.num_stack_segs; i++) {
+        assert(engine.stack_seg[i] != NULL);
+        assert(((uintptr_t)engine.stack_seg[i] & (engine.stack_seg_size - 1)) == 0);
+    }
+    ut_pool_send(silks, MAX_SEG_SILKS);
+    ut_pool_wait_shrink(MAX_SEG_SILKS);
+    for (i = 0; i < engine.num_stack_segs; i++) {
+        assert(engine.stack_seg[i] == NULL);
+    }
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    free(silks);
+}
+
+/*
+ * grow & shrink a pool whose waiting silks are hibernated
+ */
+static void
+ut_pool_hibernate (void)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = SILK_CFG_FLAG_POOL_SHRINK | SILK_CFG_FLAG_HIBERNATE,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = 16,
+        .num_stack_seperator_pages = 1,
+        .num_silk = NUM_BOOT_SILKS,
+        .max_silk = MAX_SILKS,
+        .num_grow_silks = NUM_GROW_SILKS,
+        .hibernate_msec = 1,
+        .idle_cb = ut_pool_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_t          *silks[MAX_SILKS];
+    enum silk_status_e     silk_stat;
+    uint64_t   num_hibernate;
+    int        round;
+
+
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    for (round = 0; round < NUM_HIBERNATE_ROUNDS; round++) {
+        num_hibernate = engine.num_hibernate;
+        ut_pool_fill(silks, MAX_SILKS);
+        // let the idle processing hibernate some of the waiting silks
+        while (engine.num_hibernate == num_hibernate) {
+            usleep(SLEEP_INTERVAL);
+        }
+        ut_pool_send(silks, MAX_SILKS);
+        ut_pool_wait_shrink(MAX_SILKS);
+    }
+    assert(engine.num_wakeup == engine.num_hibernate);
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+}
+
+
+int main (int   argc, char **argv)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = SILK_CFG_FLAG_POOL_SHRINK,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = 16,
+        .num_stack_seperator_pages = 4,
+        .num_silk = NUM_BOOT_SILKS,
+        .num_arena_pages = 1,
+        .max_silk = NUM_BOOT_SILKS - 1,
+        .num_grow_silks = NUM_GROW_SILKS,
+        .idle_cb = ut_pool_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_t          *silks[MAX_SILKS];
+    struct silk_msg_t      msg = {
+        .msg = SILK_MSG__APP_POOL,
+        .ctx = NULL,
+    };
+    enum silk_status_e     silk_stat;
+    uint64_t   num_grow;
+    int        i;
+
+
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_POOL_GROWTH);
+    silk_cfg.max_silk = MAX_SILKS;
+    silk_cfg.flags |= SILK_CFG_FLAG_SHARED_STACK;
+    silk_cfg.num_run_stacks = 1;
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_POOL_GROWTH);
+    silk_cfg.flags &= ~SILK_CFG_FLAG_SHARED_STACK;
+    // the msg queue must be sized for the silks the pool may grow to, not just the booted ones
+    silk_cfg.msg_queue_size = 64;
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_MSG_QUEUE_SIZE);
+    silk_cfg.msg_queue_size = 0;
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    assert(engine.cfg.num_silk == NUM_BOOT_SILKS);
+    assert(engine.cfg.msg_queue_size >= 2 * MAX_SILKS);
+
+    // grow to the maximum: 4 full chunks & a partial one
+    ut_pool_fill(silks, MAX_SILKS);
+    assert(engine.num_pool_grow == (MAX_SILKS - NUM_BOOT_SILKS + NUM_GROW_SILKS - 1) / NUM_GROW_SILKS);
+    ut_pool_send(silks, MAX_SILKS);
+    ut_pool_wait_shrink(MAX_SILKS);
+    printf("pool grew to %d silks & shrank back to %d\n", MAX_SILKS, NUM_BOOT_SILKS);
+    ut_pool_stale_msg(MAX_SILKS - 1);
+    printf("pool dropped msgs to released silks\n");
+
+    // the released silks are re-used. kill every other grown silk while it waits
+    num_grow = engine.num_pool_grow;
+    ut_pool_fill(silks, MAX_SILKS);
+    assert(engine.num_pool_grow == 2 * num_grow);
+    for (i = 0; i < MAX_SILKS; i++) {
+        if ((silks[i]->silk_id >= NUM_BOOT_SILKS) && (i % 2)) {
+            silk_stat = silk_eng_kill(&engine, silks[i]);
+        } else {
+            msg.silk_id = silks[i]->silk_id;
+            silk_stat = silk_send_msg(&engine, &msg);
+        }
+        assert(silk_stat == SILK_STAT_OK);
+    }
+    ut_pool_wait_shrink(MAX_SILKS - (MAX_SILKS - NUM_BOOT_SILKS) / 2);
+    printf("pool grew again & shrank back with killed silks\n");
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+
+    ut_pool_segments();
+    printf("pool grew over %d stack segments & released them\n",
+           (MAX_SEG_SILKS - NUM_BOOT_SILKS + SILK_STACK_SEG_SILKS - 1) / SILK_STACK_SEG_SILKS);
+    ut_pool_hibernate();
+    printf("pool grew & shrank back %d times with hibernated silks\n", NUM_HIBERNATE_ROUNDS);
+    return 0;
+}
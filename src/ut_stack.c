@@ -0,0 +1,866 @@
+/*
+ * Copyight (C) Eitan Ben-Amos, 2012
+ *
+ * a unit test program to test how the memory of the silk stacks is managed.
+ *
+ * Execution path
+ * for each stack commit policy (SILK_CFG_FLAG_STACK_COMMIT_*) we init an engine &
+ * count the resident pages of every stack (using mincore()) to verify only the pages
+ * the policy asks for were populated. we then run a silk that goes deep into its stack
+ * & verify the pages it touched became resident.
+ * for each stack release policy (SILK_CFG_FLAG_STACK_RELEASE*) we run a silk repeatedly
+ * & verify it keeps its stack while the silk it pushed beyond the warm part of the free
+ * list is released (once).
+ * with stack size classes, we verify silks get a stack of the class they ask for (or a
+ * larger one when their class is exhausted) & find their silk ID from their stack.
+ * with stack profiling, we run the deep silk & then a shallow one on the same silk &
+ * verify the stack usage recorded for each of them.
+ * with shared run stacks, many silks recurse to different depths & yield at the bottom
+ * so their stacks are saved & restored. they verify their frames survived (& one of them
+ * kills itself to exercise the recycling of a silk on a shared run stack).
+ * with hibernation, silks fill a few stack pages & wait for a msg. we verify their stack
+ * pages are released once the engine is idle long enough & that their stacks are intact
+ * when the msg wakes them up.
+ * with stack guards, silks with tiny stacks recurse until they overflow. we verify each of
+ * them is recycled (rather than crashing the process) & the engine keeps working.
+ * with huge pages, we init an engine with & without separator pages & verify the areas
+ * are aligned to huge pages (hugetlbfs pages only without separators) & silks run as usual.
+ * with NUMA binding, we verify the stacks, the silks array & the queue are bound to node 0
+ * (get_mempolicy()) & the engine thread runs on the CPUs of the node.
+ */
+
+
+#define _GNU_SOURCE // mincore() & pthread_getaffinity_np()
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "silk.h"
+
+
+/*
+ * the size of the stacks & the number of silks we use
+ */
+#define NUM_STACK_PAGES             16
+#define NUM_SILKS                   8
+
+/*
+ * the number of top pages to populate when testing SILK_CFG_FLAG_STACK_COMMIT_TOP
+ */
+#define NUM_COMMIT_PAGES            4
+
+/*
+ * the watermark & the number of warm free silks when testing SILK_CFG_FLAG_STACK_RELEASE*
+ */
+#define NUM_KEEP_PAGES              2
+#define NUM_WARM_SILKS              2
+
+/*
+ * the stack size classes we test
+ */
+#define NUM_SMALL_STACK_PAGES       4
+#define NUM_SMALL_SILKS             4
+#define NUM_LARGE_SILKS             4
+
+/*
+ * the number of pages the "deep" silk touches on its stack
+ */
+#define NUM_DEEP_PAGES              (NUM_STACK_PAGES - 4)
+
+/*
+ * the number of silks & run stacks when testing SILK_CFG_FLAG_SHARED_STACK, the number
+ * of msgs each silk waits for & the silk that kills itself
+ */
+#define NUM_SHARED_SILKS            64
+#define NUM_RUN_STACKS              2
+#define NUM_SHARED_ROUNDS           20
+#define SHARED_KILLER_SILK          5
+
+/*
+ * the number of silks, the pages each of them fills & the idle time before they are
+ * hibernated (msec) when testing SILK_CFG_FLAG_HIBERNATE
+ */
+#define NUM_HIBERNATE_SILKS         4
+#define NUM_HIBERNATE_PAGES         2
+#define HIBERNATE_MSEC              20
+
+/*
+ * the stack size & the number of silks which overflow it when testing SILK_CFG_FLAG_STACK_GUARD
+ */
+#define NUM_GUARD_STACK_PAGES       2
+#define NUM_GUARD_SILKS             4
+
+/*
+ * The application-speicifc msg we send to the silks
+ */
+#define SILK_MSG__APP_WAKEUP        SILK_MSG_APP_CODE_FIRST
+
+/*
+ * the interval (in usec) the main thread waits for the silks to progress
+ */
+#define SLEEP_INTERVAL              1000
+
+struct silk_engine_t   engine;
+
+/*
+ * set by the deep silk once it's done (& the silk ID it found from its stack)
+ */
+volatile bool        deep_silk_done;
+volatile silk_id_t   deep_silk_id;
+
+/*
+ * the number of silks which verified their frames on a shared run stack
+ */
+volatile int         num_shared_silk_done;
+
+
+static void
+ut_stack_idle_cb (struct silk_execution_thread_t   *exec_thr)
+{
+    usleep(SLEEP_INTERVAL);
+}
+
+/*
+ * count the resident pages in a range of a silk stack. "first" is the index of the
+ * first page, counting from the top of the stack (i.e.: where the stack starts).
+ */
+static int
+ut_stack_num_resident (silk_id_t   silk_id,
+                       int         first,
+                       int         num_pages)
+{
+    unsigned char   vec[NUM_STACK_PAGES];
+    void   *stack = silk_get_stack_from_id(&engine, silk_id);
+    int     rc, i, count = 0;
+
+    assert(first + num_pages <= NUM_STACK_PAGES);
+    rc = mincore(stack, NUM_STACK_PAGES * PAGE_SIZE, vec);
+    assert(rc == 0);
+    for (i = first; i < first + num_pages; i++) {
+        count += vec[NUM_STACK_PAGES - 1 - i] & 1;
+    }
+    return count;
+}
+
+/*
+ * touch "NUM_DEEP_PAGES" pages of the stack
+ */
+static void
+ut_stack_deep_entry_func (void *_arg)
+{
+    volatile char   buf[NUM_DEEP_PAGES * PAGE_SIZE];
+    int    i;
+
+    for (i = 0; i < sizeof(buf); i += PAGE_SIZE) {
+        buf[i] = 1;
+    }
+    deep_silk_id = silk__my_id();
+    deep_silk_done = true;
+}
+
+static void
+ut_stack_nop_entry_func (void *_arg)
+{
+    assert(silk__my_ctrl() == (struct silk_t*)_arg);
+}
+
+static void
+ut_stack_wait_all_free (void)
+{
+    while (engine.num_free_silk != engine.cfg.num_silk) {
+        usleep(SLEEP_INTERVAL);
+    }
+}
+
+static void
+ut_stack_run_deep_silk (uint32_t        flags,
+                        struct silk_t   **silk)
+{
+    enum silk_status_e     silk_stat;
+
+    deep_silk_done = false;
+    silk_stat = silk_alloc(&engine, ut_stack_deep_entry_func, NULL, flags, silk);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_dispatch(&engine, *silk);
+    assert(silk_stat == SILK_STAT_OK);
+    while (!deep_silk_done) {
+        usleep(SLEEP_INTERVAL);
+    }
+    ut_stack_wait_all_free();
+    assert(deep_silk_id == (*silk)->silk_id);
+}
+
+static void
+ut_stack_commit_policy (int32_t   flags)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = flags,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = NUM_STACK_PAGES,
+        .num_stack_commit_pages = NUM_COMMIT_PAGES,
+        .num_stack_seperator_pages = 1,
+        .num_silk = NUM_SILKS,
+        .idle_cb = ut_stack_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_t          *s;
+    enum silk_status_e     silk_stat;
+    int    i, num_resident;
+
+
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    for (i = 0; i < NUM_SILKS; i++) {
+        num_resident = ut_stack_num_resident(i, 0, NUM_STACK_PAGES);
+        SILK_DEBUG("Silk#%d has %d resident stack pages", i, num_resident);
+        if (flags & SILK_CFG_FLAG_STACK_COMMIT_LAZY) {
+            // only what booting the silk touched
+            assert(num_resident >= 1);
+            assert(ut_stack_num_resident(i, NUM_STACK_PAGES / 2, NUM_STACK_PAGES / 2) == 0);
+        } else if (flags & SILK_CFG_FLAG_STACK_COMMIT_TOP) {
+            assert(ut_stack_num_resident(i, 0, NUM_COMMIT_PAGES) == NUM_COMMIT_PAGES);
+            assert(ut_stack_num_resident(i, NUM_STACK_PAGES / 2, NUM_STACK_PAGES / 2) == 0);
+        } else {
+            assert(num_resident == NUM_STACK_PAGES);
+        }
+    }
+    // the pages a silk touches are resident no matter the policy
+    ut_stack_run_deep_silk(0, &s);
+    assert(ut_stack_num_resident(s->silk_id, 0, NUM_DEEP_PAGES) == NUM_DEEP_PAGES);
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+}
+
+static void
+ut_stack_release_policy (int32_t   flags)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = flags,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = NUM_STACK_PAGES,
+        .num_stack_keep_pages = NUM_KEEP_PAGES,
+        .num_warm_free_silks = NUM_WARM_SILKS,
+        .num_stack_seperator_pages = 1,
+        .num_silk = NUM_SILKS,
+        .idle_cb = ut_stack_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_t          *s, *hot_silk, *cold_silk;
+    enum silk_status_e     silk_stat;
+    int    i;
+
+
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    assert(engine.num_stack_release == 0);
+    /*
+     * the free list is LIFO so the same silk is allocated every time. once it's freed,
+     * the silk it pushed beyond the warm part of the free list is released.
+     */
+    cold_silk = silk_get_ctrl_from_id(&engine, NUM_WARM_SILKS);
+    for (i = 0; i < 4; i++) {
+        ut_stack_run_deep_silk(0, &s);
+        if (i == 0) {
+            hot_silk = s;
+        }
+        assert(s == hot_silk);
+        assert(ut_stack_num_resident(s->silk_id, 0, NUM_DEEP_PAGES) == NUM_DEEP_PAGES);
+        // the cold silk isnt released again & again
+        assert(engine.num_stack_release == 1);
+        assert(cold_silk->stack_released);
+        if (flags & SILK_CFG_FLAG_STACK_RELEASE) {
+            assert(ut_stack_num_resident(cold_silk->silk_id, NUM_KEEP_PAGES,
+                                         NUM_STACK_PAGES - NUM_KEEP_PAGES) == 0);
+        }
+        assert(ut_stack_num_resident(cold_silk->silk_id, 0, NUM_KEEP_PAGES) == NUM_KEEP_PAGES);
+    }
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+}
+
+static void
+ut_stack_classes (void)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = 0,
+        .stack_addr = (void*)NULL,
+        .num_stack_seperator_pages = 1,
+        .num_stack_classes = 2,
+        .stack_classes = {
+            { .num_stack_pages = NUM_SMALL_STACK_PAGES, .num_silk = NUM_SMALL_SILKS },
+            { .num_stack_pages = NUM_STACK_PAGES, .num_silk = NUM_LARGE_SILKS },
+        },
+        .idle_cb = ut_stack_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_t          *s, *silks[NUM_SMALL_SILKS + 1];
+    enum silk_status_e     silk_stat;
+    int    i;
+
+
+    // the classes must be ordered by stack size
+    silk_cfg.stack_classes[1].num_stack_pages = NUM_SMALL_STACK_PAGES;
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_STACK_CLASS);
+    silk_cfg.stack_classes[1].num_stack_pages = NUM_STACK_PAGES;
+
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    assert(engine.cfg.num_silk == NUM_SMALL_SILKS + NUM_LARGE_SILKS);
+    assert(silk_alloc(&engine, ut_stack_nop_entry_func, NULL, SILK_ALLOC_FLAG__STACK_CLASS(2), &s) ==
+           SILK_STAT_INVALID_STACK_CLASS);
+
+    // a deep silk must get a large stack
+    ut_stack_run_deep_silk(SILK_ALLOC_FLAG__STACK_CLASS(1), &s);
+    assert(s->silk_id >= NUM_SMALL_SILKS);
+    assert(silk_get_stack_size_from_id(&engine, s->silk_id) == NUM_STACK_PAGES * PAGE_SIZE);
+    assert(ut_stack_num_resident(s->silk_id, 0, NUM_DEEP_PAGES) == NUM_DEEP_PAGES);
+
+    // exhaust the small class & verify the next small silk gets a large stack
+    for (i = 0; i < NUM_SMALL_SILKS + 1; i++) {
+        silk_stat = silk_alloc(&engine, ut_stack_nop_entry_func, NULL, 0, &silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+        if (i < NUM_SMALL_SILKS) {
+            assert(silks[i]->silk_id < NUM_SMALL_SILKS);
+            assert(silk_get_stack_size_from_id(&engine, silks[i]->silk_id) ==
+                   NUM_SMALL_STACK_PAGES * PAGE_SIZE);
+        } else {
+            assert(silks[i]->silk_id >= NUM_SMALL_SILKS);
+        }
+        silks[i]->entry_func_arg = silks[i];
+    }
+    for (i = 0; i < NUM_SMALL_SILKS + 1; i++) {
+        silk_stat = silk_dispatch(&engine, silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+    ut_stack_wait_all_free();
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+}
+
+/*
+ * find the stack usage profile of an entry function
+ */
+static struct silk_stack_profile_t *
+ut_stack_find_profile (struct silk_stack_profile_t   *profiles,
+                       uint32_t                      num_profiles,
+                       silk_uthread_func_t           entry_func)
+{
+    int    i;
+
+    for (i = 0; i < num_profiles; i++) {
+        if (profiles[i].entry_func == entry_func) {
+            return &profiles[i];
+        }
+    }
+    return NULL;
+}
+
+static void
+ut_stack_profile (void)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = SILK_CFG_FLAG_STACK_PROFILE,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = NUM_STACK_PAGES,
+        .num_stack_seperator_pages = 1,
+        .num_silk = NUM_SILKS,
+        .idle_cb = ut_stack_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_stack_profile_t   profiles[SILK_STACK_PROFILE_MAX_FUNCS], *deep, *nop;
+    uint32_t               num_profiles = SILK_STACK_PROFILE_MAX_FUNCS;
+    struct silk_t          *s, *nop_s;
+    enum silk_status_e     silk_stat;
+    int    i;
+
+
+    // released stack pages cant be profiled
+    silk_cfg.flags |= SILK_CFG_FLAG_STACK_RELEASE;
+    silk_cfg.num_stack_keep_pages = NUM_KEEP_PAGES;
+    silk_cfg.num_warm_free_silks = NUM_WARM_SILKS;
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_STACK_RELEASE_POLICY);
+    silk_cfg.flags &= ~SILK_CFG_FLAG_STACK_RELEASE;
+
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    ut_stack_run_deep_silk(0, &s);
+    assert(s->stack_max_depth >= NUM_DEEP_PAGES * PAGE_SIZE);
+    assert(s->stack_max_depth < NUM_STACK_PAGES * PAGE_SIZE);
+    // the free list is LIFO so the shallow silks run on the stack the deep silk used
+    for (i = 0; i < 2; i++) {
+        silk_stat = silk_alloc(&engine, ut_stack_nop_entry_func, NULL, 0, &nop_s);
+        assert(silk_stat == SILK_STAT_OK);
+        assert(nop_s == s);
+        nop_s->entry_func_arg = nop_s;
+        silk_stat = silk_dispatch(&engine, nop_s);
+        assert(silk_stat == SILK_STAT_OK);
+        ut_stack_wait_all_free();
+    }
+
+    silk_stat = silk_stack_profile_get(&engine, profiles, &num_profiles);
+    assert(silk_stat == SILK_STAT_OK);
+    deep = ut_stack_find_profile(profiles, num_profiles, ut_stack_deep_entry_func);
+    nop = ut_stack_find_profile(profiles, num_profiles, ut_stack_nop_entry_func);
+    assert((deep != NULL) && (nop != NULL));
+    printf("stack usage: deep silk %u bytes, shallow silk %u bytes\n",
+           deep->max_depth, nop->max_depth);
+    assert((deep->num_exits == 1) && (deep->max_depth == s->stack_max_depth));
+    // the stack was painted again after the deep silk exited
+    assert((nop->num_exits == 2) && (nop->max_depth < 2 * PAGE_SIZE));
+    assert(nop->total_depth <= 2 * nop->max_depth);
+    assert(engine.stack_class[0].stack_max_depth == deep->max_depth);
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+}
+
+/*
+ * recurse "depth" frames, each with a buffer only this silk & frame would write, & wait
+ * for the msgs at the bottom.
+ */
+static void
+ut_stack_shared_recurse (struct silk_t   *s,
+                         int             depth)
+{
+    volatile uint32_t   buf[64];
+    struct silk_msg_t   msg;
+    int    i, round;
+
+    for (i = 0; i < sizeof(buf) / sizeof(buf[0]); i++) {
+        buf[i] = s->silk_id * 1000 + depth;
+    }
+    if (depth > 0) {
+        ut_stack_shared_recurse(s, depth - 1);
+    } else {
+        for (round = 0; round < NUM_SHARED_ROUNDS; round++) {
+            silk_yield(&msg);
+            assert((msg.msg == SILK_MSG__APP_WAKEUP) && (msg.silk_id == s->silk_id));
+            assert(silk__my_ctrl() == s);
+        }
+    }
+    for (i = 0; i < sizeof(buf) / sizeof(buf[0]); i++) {
+        assert(buf[i] == s->silk_id * 1000 + depth);
+    }
+}
+
+static void
+ut_stack_shared_entry_func (void *_arg)
+{
+    struct silk_t   *s = _arg;
+
+    assert(silk__my_ctrl() == s);
+    ut_stack_shared_recurse(s, s->silk_id % 8);
+    __sync_fetch_and_add(&num_shared_silk_done, 1);
+    if (s->silk_id == SHARED_KILLER_SILK) {
+        silk_kill(s);
+        assert(0);
+    }
+}
+
+/*
+ * dispatch all silks & send each of them a msg per round
+ */
+static void
+ut_stack_shared_run (void)
+{
+    struct silk_msg_t      msg = {
+        .msg = SILK_MSG__APP_WAKEUP,
+        .ctx = NULL,
+    };
+    struct silk_t          *silks[NUM_SHARED_SILKS];
+    enum silk_status_e     silk_stat;
+    int    i, round;
+
+    for (i = 0; i < NUM_SHARED_SILKS; i++) {
+        silk_stat = silk_alloc(&engine, ut_stack_shared_entry_func, NULL, 0, &silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+        silks[i]->entry_func_arg = silks[i];
+        silk_stat = silk_dispatch(&engine, silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+    for (round = 0; round < NUM_SHARED_ROUNDS; round++) {
+        for (i = 0; i < NUM_SHARED_SILKS; i++) {
+            msg.silk_id = silks[i]->silk_id;
+            silk_stat = silk_send_msg(&engine, &msg);
+            assert(silk_stat == SILK_STAT_OK);
+        }
+    }
+    ut_stack_wait_all_free();
+}
+
+static void
+ut_stack_shared (void)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = SILK_CFG_FLAG_SHARED_STACK,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = NUM_STACK_PAGES,
+        .num_stack_seperator_pages = 1,
+        .num_silk = NUM_SHARED_SILKS,
+        .num_run_stacks = NUM_RUN_STACKS,
+        .idle_cb = ut_stack_idle_cb,
+        .ctx = NULL,
+    };
+    enum silk_status_e     silk_stat;
+
+
+    // the run stacks cant outnumber the silks
+    silk_cfg.num_run_stacks = NUM_SHARED_SILKS + 1;
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_SHARED_STACK);
+    silk_cfg.num_run_stacks = NUM_RUN_STACKS;
+
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    // the area has only the guard, the run stacks & the switcher stack
+    assert(engine.stack_area_size == (1 + (NUM_RUN_STACKS + 1) * (NUM_STACK_PAGES + 1)) * PAGE_SIZE);
+    // run twice so the silks are reused (& the killer silk is recycled in between)
+    num_shared_silk_done = 0;
+    ut_stack_shared_run();
+    ut_stack_shared_run();
+    assert(num_shared_silk_done == 2 * NUM_SHARED_SILKS);
+    printf("shared stacks: %" PRIu64 " saves (%" PRIu64 " bytes), %" PRIu64 " restores\n",
+           engine.num_stack_save, engine.stack_save_bytes, engine.num_stack_restore);
+    assert((engine.num_stack_save > 0) && (engine.num_stack_restore > 0));
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+}
+
+static void
+ut_stack_hibernate_entry_func (void *_arg)
+{
+    struct silk_t       *s = _arg;
+    volatile char        buf[NUM_HIBERNATE_PAGES * PAGE_SIZE];
+    struct silk_msg_t    msg;
+    int    i;
+
+    for (i = 0; i < sizeof(buf); i++) {
+        buf[i] = (char)(i + s->silk_id);
+    }
+    silk_yield(&msg);
+    assert((msg.msg == SILK_MSG__APP_WAKEUP) && !s->hibernated);
+    for (i = 0; i < sizeof(buf); i++) {
+        assert(buf[i] == (char)(i + s->silk_id));
+    }
+}
+
+static void
+ut_stack_hibernate (void)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = SILK_CFG_FLAG_HIBERNATE,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = NUM_STACK_PAGES,
+        .num_stack_seperator_pages = 1,
+        .num_silk = NUM_SILKS,
+        .hibernate_msec = HIBERNATE_MSEC,
+        .idle_cb = ut_stack_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_msg_t      msg = {
+        .msg = SILK_MSG__APP_WAKEUP,
+        .ctx = NULL,
+    };
+    struct silk_t          *silks[NUM_HIBERNATE_SILKS];
+    enum silk_status_e     silk_stat;
+    int    i, num_hibernated = 0;
+
+
+    // locked stack pages cant be released
+    silk_cfg.flags |= SILK_CFG_FLAG_LOCK_STACK_MEM;
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_HIBERNATE_POLICY);
+    silk_cfg.flags &= ~SILK_CFG_FLAG_LOCK_STACK_MEM;
+
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    for (i = 0; i < NUM_HIBERNATE_SILKS; i++) {
+        silk_stat = silk_alloc(&engine, ut_stack_hibernate_entry_func, NULL, 0, &silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+        silks[i]->entry_func_arg = silks[i];
+        silk_stat = silk_dispatch(&engine, silks[i]);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+    // the engine is idle now. all silks but the one the engine runs on should hibernate
+    while (engine.num_hibernate < NUM_HIBERNATE_SILKS - 1) {
+        usleep(SLEEP_INTERVAL);
+    }
+    for (i = 0; i < NUM_HIBERNATE_SILKS; i++) {
+        if (silks[i]->hibernated) {
+            assert(ut_stack_num_resident(silks[i]->silk_id, 0, NUM_STACK_PAGES) == 0);
+            assert(silks[i]->stack_save_len > NUM_HIBERNATE_PAGES * PAGE_SIZE);
+            num_hibernated++;
+        }
+    }
+    assert(num_hibernated >= NUM_HIBERNATE_SILKS - 1);
+
+    for (i = 0; i < NUM_HIBERNATE_SILKS; i++) {
+        msg.silk_id = silks[i]->silk_id;
+        silk_stat = silk_send_msg(&engine, &msg);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+    ut_stack_wait_all_free();
+    printf("hibernation: %" PRIu64 " hibernated, %" PRIu64 " woken-up\n", engine.num_hibernate,
+           engine.num_wakeup);
+    assert(engine.num_wakeup == engine.num_hibernate);
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+}
+
+/*
+ * recurse until the stack overflows (way before we reach this depth)
+ */
+volatile int    overflow_max_depth = 1000 * 1000;
+
+static int
+ut_stack_overflow_recurse (int    depth)
+{
+    volatile char   buf[256];
+
+    buf[0] = (char)depth;
+    if (depth == overflow_max_depth) {
+        return 0;
+    }
+    return ut_stack_overflow_recurse(depth + 1) + buf[0];
+}
+
+static void
+ut_stack_overflow_entry_func (void *_arg)
+{
+    ut_stack_overflow_recurse(0);
+    assert(0);
+}
+
+static void
+ut_stack_guard (void)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = SILK_CFG_FLAG_STACK_GUARD,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = NUM_GUARD_STACK_PAGES,
+        .num_stack_seperator_pages = 0,
+        .num_silk = NUM_GUARD_SILKS,
+        // the grown silks have their guards in a stack segment
+        .max_silk = 2 * NUM_GUARD_SILKS,
+        .num_grow_silks = NUM_GUARD_SILKS,
+        .idle_cb = ut_stack_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_t          *s;
+    enum silk_status_e     silk_stat;
+    int    i;
+
+
+    // the separator pages are the guards
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_STACK_GUARD);
+    silk_cfg.num_stack_seperator_pages = 1;
+
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    // all silks overflow (inc. silk 0, which has the guard below the stacks area)
+    for (i = 0; i < 2 * NUM_GUARD_SILKS; i++) {
+        silk_stat = silk_alloc(&engine, ut_stack_overflow_entry_func, NULL, 0, &s);
+        assert(silk_stat == SILK_STAT_OK);
+        silk_stat = silk_dispatch(&engine, s);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+    while (engine.num_stack_overflow < 2 * NUM_GUARD_SILKS) {
+        usleep(SLEEP_INTERVAL);
+    }
+    ut_stack_wait_all_free();
+    // the recycled silks run as usual
+    for (i = 0; i < 2 * NUM_GUARD_SILKS; i++) {
+        silk_stat = silk_alloc(&engine, ut_stack_nop_entry_func, NULL, 0, &s);
+        assert(silk_stat == SILK_STAT_OK);
+        s->entry_func_arg = s;
+        silk_stat = silk_dispatch(&engine, s);
+        assert(silk_stat == SILK_STAT_OK);
+    }
+    ut_stack_wait_all_free();
+    assert(engine.num_stack_overflow == 2 * NUM_GUARD_SILKS);
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+}
+
+static void
+ut_stack_huge_pages (uint32_t   num_seperator_pages)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = SILK_CFG_FLAG_HUGE_PAGES,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = NUM_STACK_PAGES,
+        .num_stack_seperator_pages = num_seperator_pages,
+        .num_silk = NUM_SILKS,
+        .idle_cb = ut_stack_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_t          *s;
+    enum silk_status_e     silk_stat;
+
+
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    // the kind of pages depends on the system, but hugetlbfs pages cant have separators
+    assert((num_seperator_pages == 0) || (engine.stack_huge_page != SILK_HUGE_PAGE_HUGETLB));
+    if (engine.stack_huge_page != SILK_HUGE_PAGE_NONE) {
+        assert(((uintptr_t)engine.stack_addr & (SILK_HUGE_PAGE_SIZE - 1)) == 0);
+    }
+    if (engine.silks_huge_page != SILK_HUGE_PAGE_NONE) {
+        assert(((uintptr_t)engine.silks & (SILK_HUGE_PAGE_SIZE - 1)) == 0);
+    }
+    assert(engine.silks_area_size >= NUM_SILKS * engine.silk_size);
+    printf("stack area on %s pages, silks array on %s pages\n",
+           (engine.stack_huge_page == SILK_HUGE_PAGE_HUGETLB) ? "hugetlbfs" :
+           (engine.stack_huge_page == SILK_HUGE_PAGE_THP) ? "THP" : "regular",
+           (engine.silks_huge_page == SILK_HUGE_PAGE_HUGETLB) ? "hugetlbfs" :
+           (engine.silks_huge_page == SILK_HUGE_PAGE_THP) ? "THP" : "regular");
+    // the silks (& their stacks) work as usual
+    ut_stack_run_deep_silk(0, &s);
+    silk_stat = silk_alloc(&engine, ut_stack_nop_entry_func, NULL, 0, &s);
+    assert(silk_stat == SILK_STAT_OK);
+    s->entry_func_arg = s;
+    silk_stat = silk_dispatch(&engine, s);
+    assert(silk_stat == SILK_STAT_OK);
+    ut_stack_wait_all_free();
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+}
+
+/*
+ * verify an address is bound to NUMA node 0 (the only node every system has)
+ */
+static void
+ut_stack_assert_numa_node0 (void   *addr)
+{
+    unsigned long   nodemask[SILK_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+    int     mode = -1;
+    long    rc;
+
+    memset(nodemask, 0, sizeof(nodemask));
+    rc = syscall(SYS_get_mempolicy, &mode, nodemask, SILK_NUMA_MAX_NODES + 1, addr, MPOL_F_ADDR);
+    assert(rc == 0);
+    assert(mode == MPOL_BIND);
+    assert(nodemask[0] == 1);
+}
+
+static void
+ut_stack_numa (void)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = SILK_CFG_FLAG_NUMA_BIND,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = NUM_STACK_PAGES,
+        .num_stack_seperator_pages = 1,
+        .num_silk = NUM_SILKS,
+        .numa_node = SILK_NUMA_MAX_NODES,
+        .idle_cb = ut_stack_idle_cb,
+        .ctx = NULL,
+    };
+    struct silk_t          *s;
+    enum silk_status_e     silk_stat;
+    cpu_set_t              cpus;
+    int    rc;
+
+
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_NUMA_NODE);
+    silk_cfg.numa_node = 0;
+
+    silk_stat = silk_init(&engine, &silk_cfg);
+    assert(silk_stat == SILK_STAT_OK);
+    ut_stack_assert_numa_node0(silk_get_stack_from_id(&engine, NUM_SILKS - 1));
+    ut_stack_assert_numa_node0(silk_get_ctrl_from_id(&engine, NUM_SILKS - 1));
+    ut_stack_assert_numa_node0(&engine.msg_sched.msgs[engine.cfg.msg_queue_size / 2]);
+    rc = pthread_getaffinity_np(engine.exec_thr.id, sizeof(cpus), &cpus);
+    assert(rc == 0);
+    assert(CPU_COUNT(&cpus) > 0);
+    // the silks (& their stacks) work as usual
+    ut_stack_run_deep_silk(0, &s);
+
+    silk_stat = silk_terminate(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+    silk_stat = silk_join(&engine);
+    assert(silk_stat == SILK_STAT_OK);
+}
+
+
+int main (int   argc, char **argv)
+{
+    struct silk_engine_param_t    silk_cfg = {
+        .flags = SILK_CFG_FLAG_STACK_COMMIT_LAZY | SILK_CFG_FLAG_STACK_COMMIT_TOP,
+        .stack_addr = (void*)NULL,
+        .num_stack_pages = NUM_STACK_PAGES,
+        .num_stack_seperator_pages = 1,
+        .num_silk = NUM_SILKS,
+        .idle_cb = ut_stack_idle_cb,
+        .ctx = NULL,
+    };
+
+
+    // invalid policies
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_STACK_COMMIT_POLICY);
+    silk_cfg.flags = SILK_CFG_FLAG_STACK_COMMIT_TOP;
+    silk_cfg.num_stack_commit_pages = NUM_STACK_PAGES + 1;
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_STACK_COMMIT_POLICY);
+    silk_cfg.flags = SILK_CFG_FLAG_STACK_RELEASE;
+    silk_cfg.num_stack_keep_pages = 0;
+    silk_cfg.num_warm_free_silks = NUM_WARM_SILKS;
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_STACK_RELEASE_POLICY);
+    silk_cfg.num_stack_keep_pages = NUM_KEEP_PAGES;
+    silk_cfg.num_warm_free_silks = 0;
+    assert(silk_init(&engine, &silk_cfg) == SILK_STAT_INVALID_STACK_RELEASE_POLICY);
+
+    ut_stack_commit_policy(0);
+    printf("stack commit policy POPULATE passed\n");
+    ut_stack_commit_policy(SILK_CFG_FLAG_STACK_COMMIT_LAZY);
+    printf("stack commit policy LAZY passed\n");
+    ut_stack_commit_policy(SILK_CFG_FLAG_STACK_COMMIT_TOP);
+    printf("stack commit policy TOP passed\n");
+    ut_stack_release_policy(SILK_CFG_FLAG_STACK_RELEASE);
+    printf("stack release policy DONTNEED passed\n");
+    ut_stack_release_policy(SILK_CFG_FLAG_STACK_RELEASE_LAZY);
+    printf("stack release policy FREE passed\n");
+    ut_stack_classes();
+    printf("stack size classes passed\n");
+    ut_stack_profile();
+    printf("stack profile passed\n");
+    ut_stack_shared();
+    printf("shared stacks passed\n");
+    ut_stack_hibernate();
+    printf("hibernation passed\n");
+    ut_stack_guard();
+    printf("stack guard passed\n");
+    ut_stack_huge_pages(0);
+    printf("huge pages passed\n");
+    ut_stack_huge_pages(1);
+    printf("huge pages with separators passed\n");
+    ut_stack_numa();
+    printf("NUMA binding passed\n");
+    return 0;
+}